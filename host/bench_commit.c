@@ -0,0 +1,463 @@
+// Commit latency and wear per save scenario, measured on the simulated flash controller.
+// Each scenario starts from the same committed state and is committed once through
+// Disk.flush() (validate + rewrite_dirty_flash_pages) and once through validate_file +
+// rewrite_all_flash_pages. Times are typical datasheet erase/program times. A run of
+// sustained saves then shows what erase-ahead takes off the commit path, and a test rig
+// saving every few seconds what the erase budget saves in wear. Slow updaters show how
+// their work is spread over Disk.process() calls and reported against the callback budget. Built with BENCH_RIG_ONLY
+// (bench_budget, against a library with an erase budget) it runs only the test rig.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_common.h"
+#include "disk_stats.h"
+
+extern char _user_data_start[];
+extern char _user_data_size[];
+
+typedef struct
+{
+	const char *name;
+	const char *save;         // text the host saves, NULL = blank flash, defaults created by init
+	const char *expect[4];    // lines that must be in CONFIG.TXT after a reboot
+} scenario_t;
+
+static char long_save[4096];
+static char long_expect[2048];
+static u8 snapshot[0x20000];
+static char text[8192];
+
+static void restore(bool blank)
+{
+	u32 size = (u32)(uintptr_t)_user_data_size;
+	if (blank)
+	{
+		memset(_user_data_start, 0xFF, size);
+	}
+	else
+	{
+		memcpy(_user_data_start, snapshot, size);
+	}
+	Disk.load_from_flash();
+	Disk.init();
+	host_settle();
+}
+
+static bool persisted(const scenario_t *sc)
+{
+	Disk.load_from_flash();
+	Disk.init();
+	host_settle();
+	host_read_config(text, sizeof(text));
+	for (int i = 0; i < 4 && sc->expect[i]; i++)
+	{
+		if (strstr(text, sc->expect[i]) == NULL)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool run(const scenario_t *sc, bool all_pages)
+{
+	u16 file_len, root_addr;
+	uint64_t t0;
+
+	restore(sc->save == NULL);
+	if (sc->save == NULL)
+	{
+		memset(_user_data_start, 0xFF, (u32)(uintptr_t)_user_data_size);
+		Disk.load_from_flash();
+		Disk.init(); // creates defaults and defers the commit
+	}
+	else
+	{
+		host_save_config(sc->save);
+	}
+	hal_sim_advance_ms(FLASH_WRITE_DELAY_MS);
+
+	hal_sim_reset_stats();
+	t0 = hal_sim_now_us();
+	if (all_pages)
+	{
+		u8 *p_file = find_file((u8 *)"CONFIG  TXT", &file_len, &root_addr);
+		if (p_file && file_len > 0)
+		{
+			validate_file(p_file, root_addr);
+		}
+		rewrite_all_flash_pages();
+	}
+	else
+	{
+		Disk.flush();
+	}
+	uint64_t us = hal_sim_now_us() - t0;
+	hal_sim_stats_t st = *hal_sim_get_stats();
+	if (all_pages)
+	{
+		Disk.flush(); // drop the pending state outside the measurement
+	}
+
+	bool ok = persisted(sc);
+	printf("  %-24s %-26s %9.1f %7lu %9lu %9.1f %6lu   %s\n", sc->name,
+		   all_pages ? "rewrite_all_flash_pages" : "rewrite_dirty_flash_pages",
+		   us / 1000.0, (unsigned long)st.erases, (unsigned long)st.bytes_programmed,
+		   st.program_ns / 1e6, (unsigned long)(st.rejected_programs + st.overwrites), ok ? "yes" : "NO");
+	return ok;
+}
+
+// Back-to-back saves of a changing 200-byte value until the log has wrapped several times.
+// With idle time after each commit, erase-ahead (DISK_ERASE_AHEAD_MS) compacts the log
+// between saves and commits only program; without it they pay for the erase.
+static bool sustained(bool idle)
+{
+	char save[512];
+	u32 erasing = 0;
+	uint64_t total_us = 0, max_us = 0, ahead_us = 0;
+	const u32 saves = 1000;
+
+	restore(false);
+	for (u32 i = 0; i < saves; i++)
+	{
+		int n = snprintf(save, sizeof(save), "brightness=50\r\nvolume=75\r\nname=device\r\nkey=");
+		for (int c = 0; c < 200; c++)
+		{
+			save[n++] = 'A' + (i + c) % 26;
+		}
+		strcpy(save + n, "\r\n");
+		host_save_config(save);
+		hal_sim_advance_ms(Disk.next_deadline_ms()); // the commit delay, adaptive or not
+
+		// Everything due now belongs to the commit (updates run first with DISK_UPDATE_STEPS)
+		hal_sim_reset_stats();
+		uint64_t t0 = hal_sim_now_us();
+		do
+		{
+			Disk.process();
+		} while (Disk.next_deadline_ms() == 0);
+		uint64_t us = hal_sim_now_us() - t0;
+		erasing += hal_sim_get_stats()->erases != 0;
+		total_us += us;
+		max_us = us > max_us ? us : max_us;
+		if (idle)
+		{
+			hal_sim_advance_ms(DISK_ERASE_AHEAD_MS);
+			t0 = hal_sim_now_us();
+			Disk.process();
+			ahead_us += hal_sim_now_us() - t0;
+		}
+	}
+
+	const scenario_t sc = {"sustained saves", NULL, {"key=", NULL}};
+	bool ok = persisted(&sc);
+	printf("  %-24s %-26s %6lu saves, %4lu erasing, commit ms mean %7.1f max %7.1f, idle erase ms %9.1f   %s\n",
+		   sc.name, idle ? "idle between saves" : "no idle between saves", (unsigned long)saves,
+		   (unsigned long)erasing, total_us / 1000.0 / saves, max_us / 1000.0, ahead_us / 1000.0, ok ? "yes" : "NO");
+	return ok;
+}
+
+// A test rig rewriting CONFIG.TXT every 5 s for two hours, then ejecting. With an erase
+// budget (DISK_ERASE_BUDGET_PER_HOUR, DISK_LIFETIME_YEARS) commits are held and coalesce
+// saves; the eject still persists the last one. Up to the eject, the rig erases no more
+// than the budget allows over two hours plus the DISK_ERASE_BUDGET_BURST it starts with.
+static bool rig(void)
+{
+	char save[512];
+	const u32 saves = 1440, period_ms = 5000;
+	u32 commits = 0, erases = 0;
+	uint64_t t0 = hal_sim_now_us();
+
+	restore(false);
+	for (u32 i = 0; i < saves; i++)
+	{
+		snprintf(save, sizeof(save), "brightness=%lu\r\nvolume=75\r\nname=rig%lu\r\nkey=\r\n",
+				 (unsigned long)(i % 100), (unsigned long)i);
+		host_save_config(save);
+		for (u32 left = period_ms; left;)
+		{
+			// A tickless main loop: process() at every wakeup, then sleep until the deadline
+			hal_sim_reset_stats();
+			Disk.process();
+			commits += hal_sim_get_stats()->bytes_programmed != 0;
+			erases += hal_sim_get_stats()->erases;
+			u32 wait = Disk.next_deadline_ms();
+			if (wait == 0)
+			{
+				continue;
+			}
+			wait = MIN(wait, left);
+			hal_sim_advance_ms(wait);
+			left -= wait;
+		}
+	}
+	double hours = (hal_sim_now_us() - t0) / 3.6e9;
+	u32 budgeted = erases;
+	hal_sim_reset_stats();
+	Disk.eject();
+	Disk.process();
+	erases += hal_sim_get_stats()->erases;
+	commits += hal_sim_get_stats()->bytes_programmed != 0;
+
+	disk_budget_t budget;
+	Disk.get_budget(&budget);
+	snprintf(save, sizeof(save), "name=rig%lu\t", (unsigned long)(saves - 1));
+	const scenario_t sc = {"test rig, save every 5 s", NULL, {save, NULL}};
+	bool ok = persisted(&sc) &&
+			  (!budget.per_hour_milli || budgeted <= budget.per_hour_milli / 1000.0 * hours + DISK_ERASE_BUDGET_BURST);
+	printf("  %-24s budget %5lu.%03lu/h    %6lu saves, %4lu commits, %4lu erases (%.1f/h), %lu held, projected %lu days   %s\n",
+		   sc.name, (unsigned long)(budget.per_hour_milli / 1000), (unsigned long)(budget.per_hour_milli % 1000),
+		   (unsigned long)saves, (unsigned long)commits, (unsigned long)erases, erases / hours,
+		   (unsigned long)budget.held, (unsigned long)budget.projected_days, ok ? "yes" : "NO");
+	return ok;
+}
+
+// Disk.eject() while nothing is pending, a USB suspend on an idle bus, then a save: its
+// first sector must not commit it before the rest of the save lands
+static bool idle_eject(void)
+{
+	const char *save = "brightness=33\r\nvolume=75\r\nname=idle\r\nkey=\r\n";
+	u8 sector[HOST_SECTOR_SIZE] = {0};
+
+	restore(false);
+	Disk.eject();
+	Disk.process();
+	memcpy(sector, save, strlen(save));
+	Disk.Disk_SecWrite(sector, HOST_DATA_SECTOR, 1);
+	u32 wait = Disk.next_deadline_ms();
+	hal_sim_reset_stats();
+	hal_sim_advance_ms(1);
+	Disk.process();
+	u32 early = hal_sim_get_stats()->bytes_programmed;
+	host_save_config(save);
+	host_settle();
+
+	const scenario_t sc = {"eject while idle, save", NULL, {"brightness=33\t", "name=idle\t", NULL}};
+	bool ok = wait != 0 && early == 0 && persisted(&sc);
+	printf("  %-24s first sector: deadline %lu ms, %lu bytes programmed   %s\n", sc.name, (unsigned long)wait,
+		   (unsigned long)early, ok ? "yes" : "NO");
+	return ok;
+}
+
+// A host save landing after a commit has programmed flash but before it returns (in the
+// commit task a commit may take a second): the save is not in flash and needs its own commit
+static void save_during_commit(void)
+{
+	host_save_config("brightness=44\r\nvolume=75\r\nname=racer\r\nkey=\r\n");
+}
+
+static bool racing_save(void)
+{
+	u32 wait;
+
+	restore(false);
+	host_save_config("brightness=43\r\nvolume=75\r\nname=first\r\nkey=\r\n");
+	hal_sim_on_flash_lock(save_during_commit);
+	Disk.flush();
+	hal_sim_on_flash_lock(NULL);
+	wait = Disk.next_deadline_ms();
+	host_settle();
+
+	const scenario_t sc = {"save during a commit", NULL, {"brightness=44\t", "name=racer\t", NULL}};
+	bool ok = wait != DISK_NO_DEADLINE && persisted(&sc);
+	printf("  %-24s after the commit: deadline %ld ms   %s\n", sc.name,
+		   wait == DISK_NO_DEADLINE ? -1L : (long)wait, ok ? "yes" : "NO");
+	return ok;
+}
+
+#if DISK_STATS
+// A save with a rejected value and a changed one, then an eject: with DISK_UPDATE_STEPS the
+// first pass only queues the update and the commit validates the re-rendered file, where the
+// default has replaced the rejected value. The commit still counts as a validation failure.
+static bool rejected_value(void)
+{
+	u32 wait;
+
+	restore(false);
+	u32 failures = DiskStats.get()->validation_failures;
+	host_save_config("brightness=abc\r\nvolume=76\r\nname=device\r\nkey=\r\n");
+	while ((wait = Disk.next_deadline_ms()) != 0)
+	{
+		hal_sim_advance_ms(wait);
+	}
+	Disk.process();
+	Disk.eject();
+	Disk.process();
+	host_settle();
+	failures = DiskStats.get()->validation_failures - failures;
+
+	const scenario_t sc = {"rejected value, eject", NULL, {"brightness=50\t", "volume=76\t", NULL}};
+	bool ok = failures == 1 && persisted(&sc);
+	printf("  %-24s commits counted as rejected +%lu   %s\n", sc.name, (unsigned long)failures, ok ? "yes" : "NO");
+	return ok;
+}
+#endif
+
+// Entries whose updaters busy-wait SLOW_US on the wall clock, the time base the callbacks
+// are timed on (disk_prof_now())
+#define SLOW_CNT 3
+#define SLOW_US 4000
+static const char *const slow_names[SLOW_CNT] = {"motor_a", "motor_b", "motor_c"};
+static u32 slow_values[SLOW_CNT], slow_calls;
+
+static bool slow_validator(u8 str[])
+{
+	return str[0] >= '0' && str[0] <= '9';
+}
+
+static void slow_update(u32 m, u8 str[])
+{
+	uint64_t t0 = host_now_ns();
+	while (host_now_ns() - t0 < SLOW_US * 1000ULL)
+	{
+	}
+	slow_values[m] = atoi((char *)str);
+	slow_calls++;
+}
+
+static void slow_print(u32 m, char *buffer, size_t buffer_size)
+{
+	snprintf(buffer, buffer_size, "%s=%lu", slow_names[m], (unsigned long)slow_values[m]);
+}
+
+static void motor_a_updater(u8 str[]) { slow_update(0, str); }
+static void motor_b_updater(u8 str[]) { slow_update(1, str); }
+static void motor_c_updater(u8 str[]) { slow_update(2, str); }
+static void motor_a_printer(char *buffer, size_t buffer_size) { slow_print(0, buffer, buffer_size); }
+static void motor_b_printer(char *buffer, size_t buffer_size) { slow_print(1, buffer, buffer_size); }
+static void motor_c_printer(char *buffer, size_t buffer_size) { slow_print(2, buffer, buffer_size); }
+
+// All slow values changed in one save, written as "07" so the printers normalize them.
+// motor_c has no budget: it is only measured. Checks the updates per process() call
+// (one with DISK_UPDATE_STEPS, the updaters outlast DISK_UPDATE_SLICE_US), a single
+// commit, the overruns (DISK_CALLBACK_BUDGET_US) and the printed values after a reboot.
+static bool slow_updaters(void)
+{
+	Disk.register_entry("motor_a", "1", "#(rpm)", slow_validator, motor_a_updater, motor_a_printer);
+	Disk.register_entry("motor_b", "1", "#(rpm)", slow_validator, motor_b_updater, motor_b_printer);
+	Disk.register_entry("motor_c", "1", "#(rpm)", slow_validator, motor_c_updater, motor_c_printer);
+	Disk.set_callback_budget("motor_c", 0);
+	restore(false); // the snapshot lacks the new entries: their defaults are applied and committed
+
+	disk_callback_t before[8], after[8];
+	u32 n = Disk.get_callbacks(before, 8);
+	host_save_config("brightness=50\r\nvolume=75\r\nname=device\r\nkey=\r\n"
+					 "motor_a=07\r\nmotor_b=08\r\nmotor_c=09\r\n");
+	hal_sim_advance_ms(Disk.next_deadline_ms());
+
+	u32 calls = 0, commits = 0, most = 0;
+	uint64_t longest_ns = 0;
+	do
+	{
+		u32 updates = slow_calls;
+		hal_sim_reset_stats();
+		uint64_t t0 = host_now_ns();
+		Disk.process();
+		uint64_t ns = host_now_ns() - t0;
+		longest_ns = ns > longest_ns ? ns : longest_ns;
+		most = MAX(most, slow_calls - updates);
+		commits += hal_sim_get_stats()->bytes_programmed != 0;
+		calls++;
+	} while (Disk.next_deadline_ms() == 0);
+	Disk.get_callbacks(after, 8);
+
+	bool ok = commits == 1 && most == (DISK_UPDATE_STEPS ? 1 : SLOW_CNT);
+	u32 overruns[SLOW_CNT] = {0};
+	for (u32 i = 0; i < n; i++)
+	{
+		for (u32 m = 0; m < SLOW_CNT; m++)
+		{
+			if (strcmp(after[i].entry, slow_names[m]) == 0)
+			{
+				overruns[m] = after[i].overruns - before[i].overruns;
+				// Over budget once each, the unbudgeted one only measured
+				ok &= overruns[m] == (m < 2 && DISK_CALLBACK_BUDGET_US < SLOW_US);
+				ok &= after[i].max_us[DISK_CALLBACK_UPDATE] >= SLOW_US;
+			}
+		}
+	}
+	const scenario_t sc = {"slow updaters (3 x 4 ms)", NULL, {"motor_a=7\t", "motor_b=8\t", "motor_c=9\t", NULL}};
+	ok &= persisted(&sc);
+	printf("  %-24s longest process() %5.1f ms, %2lu calls, %lu updates per call at most, %lu commits, "
+		   "overruns %lu/%lu/%lu   %s\n",
+		   sc.name, longest_ns / 1e6, (unsigned long)calls, (unsigned long)most, (unsigned long)commits,
+		   (unsigned long)overruns[0], (unsigned long)overruns[1], (unsigned long)overruns[2], ok ? "yes" : "NO");
+	return ok;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	hal_sim_init();
+	host_register_entries();
+
+	memset(long_expect, 0, sizeof(long_expect));
+	strcpy(long_expect, "key=");
+	for (int i = 0; i < 1500; i++)
+	{
+		long_expect[4 + i] = 'A' + i % 26;
+	}
+	snprintf(long_save, sizeof(long_save), "brightness=50\r\nvolume=75\r\nname=device\r\n%s\r\n", long_expect);
+
+	const scenario_t scenarios[] = {
+		{"defaults on blank flash", NULL, {"brightness=50\t", "volume=75\t", "name=device\t", NULL}},
+		{"edit one value", "brightness=80\r\nvolume=75\r\nname=device\r\nkey=\r\n", {"brightness=80\t", "volume=75\t", NULL}},
+		{"save unchanged", "brightness=50\r\nvolume=75\r\nname=device\r\nkey=\r\n", {"brightness=50\t", NULL}},
+		{"long value (1.5KB)", long_save, {long_expect, "name=device\t", NULL}},
+	};
+
+	// Reference state every scenario starts from: defaults committed to flash
+	Disk.init();
+	host_settle();
+	memcpy(snapshot, _user_data_start, (u32)(uintptr_t)_user_data_size);
+
+	printf("%s, user region 0x%08lX + %lu bytes\n", hal_sim_device_name(),
+		   (unsigned long)(uintptr_t)_user_data_start, (unsigned long)(uintptr_t)_user_data_size);
+#if BENCH_RIG_ONLY
+	(void)scenarios;
+	return rig() ? 0 : 1;
+#endif
+	printf("  %-24s %-26s %9s %7s %9s %9s %6s   %s\n", "scenario", "commit path", "commit ms",
+		   "erases", "bytes", "prog ms", "reject", "persisted");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+	{
+		failures += !run(&scenarios[i], false);
+		failures += !run(&scenarios[i], true);
+	}
+	failures += !sustained(false);
+	failures += !sustained(true);
+	failures += !rig();
+	failures += !idle_eject();
+	failures += !racing_save();
+#if DISK_STATS
+	failures += !rejected_value();
+#endif
+	failures += !slow_updaters();
+#if DISK_STORE_TLV
+	// "volume_czcc" has the config store key of "volume": it must not share its records
+	bool rejected = !Disk.register_entry("volume_czcc", "75", "#(0~100)", NULL, NULL, NULL);
+	printf("  %-24s %-26s   %s\n", "config store key clash", "volume_czcc rejected", rejected ? "yes" : "NO");
+	failures += !rejected;
+#endif
+
+	// Wear across the user region over the whole run
+	u32 min = 0xFFFFFFFF, max = 0;
+	for (u32 u = 0; u < hal_sim_erase_unit_count(); u++)
+	{
+		u32 base = hal_sim_erase_unit_base(u);
+		if (base < (u32)(uintptr_t)_user_data_start ||
+			base >= (u32)(uintptr_t)_user_data_start + (u32)(uintptr_t)_user_data_size)
+		{
+			continue;
+		}
+		u32 n = hal_sim_erase_count(u);
+		min = n < min ? n : min;
+		max = n > max ? n : max;
+	}
+	printf("  erase cycles per erase unit in the user region: min %lu, max %lu\n",
+		   (unsigned long)min, (unsigned long)max);
+	return failures ? 1 : 0;
+}
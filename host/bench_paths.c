@@ -0,0 +1,122 @@
+// Runs every library path on the host and reports wall-clock cost per call.
+// Usage: bench_paths [iterations]
+// Built with PROF=1, it also prints the library's own probe table (disk_prof.h).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk_copy.h"
+#include "disk_prof.h"
+#include "host_common.h"
+
+static char text[8192];
+
+#define TIME_LOOP(label, iterations, body)                                        \
+	do                                                                            \
+	{                                                                             \
+		uint64_t t0 = host_now_ns();                                              \
+		for (int it_ = 0; it_ < (iterations); it_++)                              \
+		{                                                                         \
+			body;                                                                 \
+		}                                                                         \
+		double ns_ = (double)(host_now_ns() - t0) / (iterations);                 \
+		printf("  %-34s %12.1f ns/call\n", label, ns_);                           \
+	} while (0)
+
+static void print_probes(void)
+{
+	printf("  %-18s %8s %10s %10s %10s   log2(ns) histogram\n", "probe", "count", "min us", "mean us", "max us");
+	for (u32 i = 0; i < DISK_PROF_PROBE_CNT; i++)
+	{
+		const disk_prof_probe_t *p = DiskProf.get(i);
+		if (p->count == 0)
+		{
+			continue;
+		}
+		printf("  %-18s %8lu %10.2f %10.2f %10.2f  ", DiskProf.name(i), (unsigned long)p->count, p->min / 1e3,
+			   (double)p->total / p->count / 1e3, p->max / 1e3);
+		for (u32 b = 0; b < DISK_PROF_HIST_BINS; b++)
+		{
+			if (p->hist[b])
+			{
+				printf(" %lu:%lu", (unsigned long)b, (unsigned long)p->hist[b]);
+			}
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+	u8 sector[512];
+	static u8 multi[8 * 512];
+	u16 file_len, root_addr;
+	int failures = 0;
+
+	hal_sim_init();
+	host_register_entries();
+	DiskProf.init();
+	printf("%s, %d iterations\n", hal_sim_device_name(), iterations);
+
+	uint64_t t0 = host_now_ns();
+	Disk.init();
+	printf("  %-34s %12.1f ns/call\n", "init (blank flash, defaults)", (double)(host_now_ns() - t0));
+	host_settle();
+
+	TIME_LOOP("read_sector boot", iterations, Disk.Disk_SecRead(sector, 0));
+	TIME_LOOP("read_sector FAT1", iterations, Disk.Disk_SecRead(sector, HOST_FAT1_SECTOR));
+	TIME_LOOP("read_sector root dir", iterations, Disk.Disk_SecRead(sector, HOST_ROOT_SECTOR));
+	TIME_LOOP("read_sector file data", iterations, Disk.Disk_SecRead(sector, HOST_DATA_SECTOR));
+	TIME_LOOP("read_sector unused data", iterations, Disk.Disk_SecRead(sector, 1000));
+	TIME_LOOP("read full volume (4096 sectors)", 10,
+			  for (u32 s = 0; s < Disk.get_sector_count(); s++) Disk.Disk_SecRead(sector, s));
+
+	TIME_LOOP("Disk_SecReadMulti 8 file sectors", iterations, Disk.Disk_SecReadMulti(multi, HOST_DATA_SECTOR, 8));
+	printf("  %-34s %12lu ns/sector copy, %lu ns/sector zero-fill\n", "copy engine cpu",
+		   (unsigned long)DiskCopy.measure(DiskCopy.cpu, false), (unsigned long)DiskCopy.measure(DiskCopy.cpu, true));
+
+	Disk.Disk_SecRead(sector, HOST_DATA_SECTOR);
+	TIME_LOOP("write_sector unchanged data", iterations, Disk.Disk_SecWrite(sector, HOST_DATA_SECTOR, 1));
+	host_settle();
+
+	host_read_config(text, sizeof(text));
+	TIME_LOOP("host save (data+FAT1+FAT2+dir)", iterations,
+			  host_save_config("brightness=80\r\nvolume=20\r\nname=bench\r\n"));
+	t0 = host_now_ns();
+	Disk.flush();
+	printf("  %-34s %12.1f ns/call\n", "flush (validate + commit)", (double)(host_now_ns() - t0));
+
+	u8 *p_file = find_file((u8 *)"CONFIG  TXT", &file_len, &root_addr);
+	TIME_LOOP("validate_file", iterations, validate_file(p_file, root_addr));
+	TIME_LOOP("rewrite_dirty_flash_pages (2 dirty)", 10,
+			  {
+				  validate_file(p_file, root_addr);
+				  rewrite_dirty_flash_pages();
+			  });
+	TIME_LOOP("rewrite_all_flash_pages", 10, rewrite_all_flash_pages());
+
+	// Reboot from flash and make sure the edit survived
+	t0 = host_now_ns();
+	Disk.load_from_flash();
+	Disk.init();
+	printf("  %-34s %12.1f ns/call\n", "init (reboot from flash)", (double)(host_now_ns() - t0));
+	host_settle();
+	host_read_config(text, sizeof(text));
+	const char *expect[] = {"brightness=80\t", "volume=20\t", "name=bench\t", "key=\t"};
+	for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); i++)
+	{
+		if (strstr(text, expect[i]) == NULL)
+		{
+			printf("  after reboot: missing \"%.*s\"\n", (int)strlen(expect[i]) - 1, expect[i]);
+			failures++;
+		}
+	}
+	printf("  reboot check: %s\n", failures ? "FAILED" : "ok");
+	if (DISK_PROF)
+	{
+		print_probes();
+	}
+	return failures ? 1 : 0;
+}
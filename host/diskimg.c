@@ -0,0 +1,252 @@
+// Virtual disk image tool.
+//
+//   diskimg export <image>   dump all sectors through Disk_SecReadMulti, report read throughput
+//   diskimg import <image>   feed sectors that differ from the device back through
+//                            write_sector (data, then FAT, then directory, like a host),
+//                            pump process() and report the round-trip edit latency
+//   diskimg check <image>    BPB/FAT consistency checks (what fsck.fat -n looks at)
+//
+// The simulated flash only survives between invocations when HAL_SIM_FLASH_FILE is set.
+// fatcheck.sh drives this tool together with fsck.fat and mtools.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_common.h"
+
+#define SECTOR_SIZE HOST_SECTOR_SIZE
+
+static u8 *image;
+static u32 sector_cnt;
+
+static u16 rd16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 rd32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static bool load_image(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+	{
+		perror(path);
+		return false;
+	}
+	size_t n = fread(image, SECTOR_SIZE, sector_cnt, f);
+	fclose(f);
+	if (n != sector_cnt)
+	{
+		fprintf(stderr, "%s: expected %lu sectors, got %zu\n", path, (unsigned long)sector_cnt, n);
+		return false;
+	}
+	return true;
+}
+
+static int export_image(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f)
+	{
+		perror(path);
+		return 1;
+	}
+
+	uint64_t t0 = host_now_ns();
+	Disk.Disk_SecReadMulti(image, 0, sector_cnt);
+	uint64_t ns = host_now_ns() - t0;
+
+	if (fwrite(image, SECTOR_SIZE, sector_cnt, f) != sector_cnt)
+	{
+		perror(path);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	printf("exported %lu sectors in %.3f ms: %.1f MB/s, %.1f ns/sector\n", (unsigned long)sector_cnt,
+		   ns / 1e6, (double)sector_cnt * SECTOR_SIZE / (ns / 1e9) / 1e6, (double)ns / sector_cnt);
+	return 0;
+}
+
+static int import_image(const char *path)
+{
+	u8 current[SECTOR_SIZE];
+	u32 changed = 0;
+
+	if (!load_image(path))
+	{
+		return 1;
+	}
+
+	// Hosts write file data before the FAT and the directory entry that make it visible
+	const u32 order[][2] = {{HOST_DATA_SECTOR, sector_cnt}, {1, HOST_ROOT_SECTOR}, {HOST_ROOT_SECTOR, HOST_DATA_SECTOR}, {0, 1}};
+	uint64_t t0 = host_now_ns();
+	uint64_t v0 = hal_sim_now_us();
+	for (u32 r = 0; r < sizeof(order) / sizeof(order[0]); r++)
+	{
+		for (u32 s = order[r][0]; s < order[r][1]; s++)
+		{
+			Disk.Disk_SecRead(current, s);
+			if (memcmp(current, image + s * SECTOR_SIZE, SECTOR_SIZE))
+			{
+				Disk.Disk_SecWrite(image + s * SECTOR_SIZE, s, 1);
+				changed++;
+			}
+		}
+	}
+	uint64_t write_ns = host_now_ns() - t0;
+	hal_sim_reset_stats();
+	host_settle();
+	uint64_t total_ns = host_now_ns() - t0;
+
+	printf("imported %lu changed sectors: host time %.3f ms (writes %.3f ms), persisted after %.1f ms "
+		   "of device time, %lu erases, %lu bytes programmed\n",
+		   (unsigned long)changed, total_ns / 1e6, write_ns / 1e6, (hal_sim_now_us() - v0) / 1000.0,
+		   (unsigned long)hal_sim_get_stats()->erases, (unsigned long)hal_sim_get_stats()->bytes_programmed);
+	return 0;
+}
+
+// check
+
+static int problems;
+
+__attribute__((format(printf, 1, 2))) static void problem(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	printf("  ");
+	vprintf(fmt, args);
+	printf("\n");
+	va_end(args);
+	problems++;
+}
+
+static int check_image(const char *path)
+{
+	if (!load_image(path))
+	{
+		return 1;
+	}
+	const u8 *bs = image;
+	u32 bytes_per_sector = rd16(bs + 11);
+	u32 sec_per_clus = bs[13];
+	u32 reserved = rd16(bs + 14);
+	u32 fats = bs[16];
+	u32 root_entries = rd16(bs + 17);
+	u32 total = rd16(bs + 19) ? rd16(bs + 19) : rd32(bs + 32);
+	u32 media = bs[21];
+	u32 fat_size = rd16(bs + 22);
+
+	printf("%s: %lu sectors of %lu bytes\n", path, (unsigned long)total, (unsigned long)bytes_per_sector);
+	if (bs[0] != 0xEB && bs[0] != 0xE9)
+		problem("boot sector: bad jump instruction 0x%02X", bs[0]);
+	if (bs[510] != 0x55 || bs[511] != 0xAA)
+		problem("boot sector: missing 0x55AA signature (found 0x%02X%02X)", bs[510], bs[511]);
+	if (bytes_per_sector != SECTOR_SIZE)
+		problem("BPB: %u bytes per sector, device reports %u", bytes_per_sector, SECTOR_SIZE);
+	if (total != sector_cnt)
+		problem("BPB: %u total sectors, device reports %u", total, sector_cnt);
+	if (sec_per_clus == 0 || fats == 0 || fat_size == 0)
+		problem("BPB: zero sectors per cluster (%u) or FAT sectors (%u)", sec_per_clus, fats * fat_size);
+	if (problems)
+	{
+		return 1;
+	}
+
+	u32 root_sectors = (root_entries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	u32 first_root = reserved + fats * fat_size;
+	u32 first_data = first_root + root_sectors;
+	u32 clusters = (sector_cnt - first_data) / sec_per_clus;
+	const u8 *fat = image + reserved * SECTOR_SIZE;
+
+	if (clusters >= 4085)
+		problem("BPB: %u clusters is too many for FAT12 (max 4084)", clusters);
+	if ((clusters + 2) * 3 / 2 > fat_size * SECTOR_SIZE)
+		problem("BPB: FAT of %u bytes cannot map %u clusters", fat_size * SECTOR_SIZE, clusters);
+	if (fat[0] != media || fat[1] != 0xFF || fat[2] != 0xFF)
+		problem("FAT: first entry 0x%02X does not match media descriptor 0x%02X", fat[0], media);
+	for (u32 i = 1; i < fats; i++)
+	{
+		if (memcmp(fat, fat + i * fat_size * SECTOR_SIZE, fat_size * SECTOR_SIZE))
+			problem("FAT: copy %u differs from the first FAT", i);
+	}
+
+	// Walk every directory entry's cluster chain
+	u8 *owner = calloc(clusters + 2, 1);
+	const u8 *dir = image + first_root * SECTOR_SIZE;
+	for (u32 e = 0; e < root_entries; e++)
+	{
+		const u8 *de = dir + e * 32;
+		if (de[0] == 0x00)
+			break;
+		if (de[0] == 0xE5 || de[11] == 0x0F || (de[11] & 0x08))
+			continue;
+		u32 size = rd32(de + 28);
+		u32 need = (de[11] & 0x10) ? 0 : (size + sec_per_clus * SECTOR_SIZE - 1) / (sec_per_clus * SECTOR_SIZE);
+		u32 len = 0;
+		for (u16 c = rd16(de + 26); c >= 2 && c < 0xFF8; c = host_fat12_get(fat, c))
+		{
+			if (c >= clusters + 2)
+			{
+				problem("dir entry %u: chain points past the last cluster (%u)", e, c);
+				break;
+			}
+			if (owner[c])
+			{
+				problem("dir entry %u: cluster %u is cross-linked", e, c);
+				break;
+			}
+			owner[c] = 1;
+			len++;
+		}
+		if (need && len != need)
+			problem("dir entry %u: size needs %u clusters, chain has %u", e, need, len);
+	}
+	for (u32 c = 2; c < clusters + 2; c++)
+	{
+		u16 v = host_fat12_get(fat, c);
+		if (v != 0 && v != 0xFF7 && !owner[c])
+			problem("FAT: cluster %u allocated (0x%03X) but not reachable from the root", c, v);
+	}
+	free(owner);
+	printf("  %d problem%s\n", problems, problems == 1 ? "" : "s");
+	return problems ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s export|import|check <image>\n", argv[0]);
+		return 2;
+	}
+	sector_cnt = Disk.get_sector_count();
+	image = malloc(sector_cnt * SECTOR_SIZE);
+
+	if (strcmp(argv[1], "check") == 0)
+	{
+		return check_image(argv[2]);
+	}
+
+	hal_sim_init();
+	host_register_entries();
+	Disk.init();
+	host_settle();
+
+	if (strcmp(argv[1], "export") == 0)
+	{
+		return export_image(argv[2]);
+	}
+	if (strcmp(argv[1], "import") == 0)
+	{
+		return import_image(argv[2]);
+	}
+	fprintf(stderr, "unknown command %s\n", argv[1]);
+	return 2;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Round-trips the virtual disk through dosfstools and mtools on Linux:
+# export, fsck.fat, edit CONFIG.TXT with mdel/mcopy, import, export again, fsck.fat.
+# Needs fsck.fat (dosfstools) and mtools. Usage: ./fatcheck.sh [f103|f411|f401|f446|l432|g071]
+set -e
+
+dev=${1:-f411}
+tool=build/$dev/diskimg
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+export HAL_SIM_FLASH_FILE="$work/flash.bin"
+export MTOOLS_SKIP_CHECK=1
+
+"$tool" export "$work/disk.img"
+"$tool" check "$work/disk.img"
+fsck.fat -n -v "$work/disk.img"
+
+mtype -i "$work/disk.img" ::CONFIG.TXT > "$work/config.txt"
+sed 's/^brightness=[0-9]*/brightness=42/' "$work/config.txt" > "$work/edited.txt"
+mdel -i "$work/disk.img" ::CONFIG.TXT
+mcopy -i "$work/disk.img" "$work/edited.txt" ::CONFIG.TXT
+
+"$tool" import "$work/disk.img"
+"$tool" export "$work/after.img"
+fsck.fat -n "$work/after.img"
+"$tool" check "$work/after.img"
+mdir -i "$work/after.img" ::
+
+if mtype -i "$work/after.img" ::CONFIG.TXT | grep -q '^brightness=42'; then
+	echo "round trip: ok"
+else
+	echo "round trip: CONFIG.TXT lost the edit"
+	exit 1
+fi
@@ -0,0 +1,429 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk_flash.h"
+
+// The simulated device is the one the library is built for: its erase units, program
+// widths and typical timings come from the same descriptor (src/disk_flash.c)
+#define SIM_UNIT_MAX 256
+
+static const disk_flash_geometry_t *geometry(void)
+{
+	return DiskFlash.geometry();
+}
+
+static const disk_flash_run_t *unit_run(uint32_t unit)
+{
+	const disk_flash_geometry_t *g = geometry();
+	for (uint32_t i = 0; i < DISK_FLASH_RUNS && g->runs[i].count; i++)
+	{
+		if (unit < g->runs[i].count)
+		{
+			return &g->runs[i];
+		}
+		unit -= g->runs[i].count;
+	}
+	return NULL;
+}
+
+static uint32_t unit_size(uint32_t unit)
+{
+	const disk_flash_run_t *run = unit_run(unit);
+	return run ? run->size : 0;
+}
+
+static uint32_t width_index(uint32_t width)
+{
+	return __builtin_ctz(width);
+}
+
+static uint32_t erase_time_us(uint32_t unit, uint32_t parallelism)
+{
+	return unit_run(unit)->erase_ms[width_index(parallelism)] * 1000;
+}
+
+// Operations of the widest native width up to the parallelism: the F4 splits wider
+// writes by PSIZE, the F1 HAL splits words into half-words
+static uint64_t program_time_ns(uint32_t len, uint32_t parallelism)
+{
+	const disk_flash_geometry_t *g = geometry();
+	uint32_t w = len < parallelism ? len : parallelism;
+	while (w > 1 && !g->program_ns[width_index(w)])
+	{
+		w >>= 1;
+	}
+	return (uint64_t)g->program_ns[width_index(w)] * (len / w);
+}
+
+FLASH_TypeDef hal_sim_flash_regs;
+
+static uint8_t *flash_mem = NULL;
+static uint32_t flash_size = 0;
+static bool flash_locked = true;
+static bool wall_clock = false;
+static uint64_t virtual_ns = 0;
+static hal_sim_stats_t stats;
+static uint32_t erase_counts[SIM_UNIT_MAX];
+static void (*lock_hook)(void); // hal_sim_on_flash_lock()
+
+// Worn cells: bits that stay 1 when programmed (hal_sim_stuck_bits)
+#define SIM_FAULT_CNT 16
+static struct
+{
+	uint32_t address;
+	uint8_t bits;
+	uint32_t count; // program operations left, UINT32_MAX = for good
+} faults[SIM_FAULT_CNT];
+static uint32_t fault_cnt;
+static uint32_t program_parallelism; // widest program operation in bytes, on F4 latched from the last erase like PSIZE
+
+// geometry
+
+uint32_t hal_sim_erase_unit_count(void)
+{
+	const disk_flash_geometry_t *g = geometry();
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < DISK_FLASH_RUNS; i++)
+	{
+		n += g->runs[i].count;
+	}
+	return n < SIM_UNIT_MAX ? n : SIM_UNIT_MAX;
+}
+
+uint32_t hal_sim_erase_unit_size(uint32_t unit)
+{
+	return unit < hal_sim_erase_unit_count() ? unit_size(unit) : 0;
+}
+
+uint32_t hal_sim_erase_unit_base(uint32_t unit)
+{
+	uint32_t addr = hal_sim_flash_base();
+	for (uint32_t i = 0; i < unit && i < hal_sim_erase_unit_count(); i++)
+	{
+		addr += unit_size(i);
+	}
+	return addr;
+}
+
+uint32_t hal_sim_flash_base(void)
+{
+	return geometry()->base;
+}
+
+uint32_t hal_sim_flash_size(void)
+{
+	return hal_sim_erase_unit_base(hal_sim_erase_unit_count()) - hal_sim_flash_base();
+}
+
+const char *hal_sim_device_name(void)
+{
+	return geometry()->name;
+}
+
+static bool in_flash(uint32_t address, uint32_t len)
+{
+	return address >= hal_sim_flash_base() && address + len <= hal_sim_flash_base() + flash_size;
+}
+
+// setup
+
+void hal_sim_init(void)
+{
+	const char *path = getenv("HAL_SIM_FLASH_FILE");
+	int fd = -1;
+	int flags = MAP_FIXED_NOREPLACE;
+	bool fresh = true;
+
+	if (flash_mem)
+	{
+		return;
+	}
+	flash_size = hal_sim_flash_size();
+	program_parallelism = DiskFlash.width();
+
+	if (path && *path)
+	{
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			fprintf(stderr, "hal_sim: cannot open %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+		off_t len = lseek(fd, 0, SEEK_END);
+		fresh = len != (off_t)flash_size;
+		if (fresh && ftruncate(fd, flash_size) != 0)
+		{
+			fprintf(stderr, "hal_sim: cannot size %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+		flags |= MAP_SHARED;
+	}
+	else
+	{
+		flags |= MAP_PRIVATE | MAP_ANONYMOUS;
+	}
+
+	// The library addresses flash through 32-bit integers (linker symbols, HAL calls),
+	// so the flash has to live at its real address, not wherever mmap would put it
+	void *mem = mmap((void *)(uintptr_t)hal_sim_flash_base(), flash_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (mem == MAP_FAILED || mem != (void *)(uintptr_t)hal_sim_flash_base())
+	{
+		fprintf(stderr, "hal_sim: cannot map flash at 0x%08lX: %s\n", (unsigned long)hal_sim_flash_base(),
+				strerror(errno));
+		exit(1);
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	flash_mem = mem;
+	if (fresh)
+	{
+		hal_sim_erase_all();
+	}
+	flash_locked = true;
+
+	const char *stuck = getenv("HAL_SIM_STUCK");
+	if (stuck && *stuck)
+	{
+		char *end;
+		uint32_t address = strtoul(stuck, &end, 0);
+		uint32_t bits = *end == ':' ? strtoul(end + 1, &end, 0) : 0xFF;
+		uint32_t count = *end == ':' ? strtoul(end + 1, &end, 0) : 0;
+		hal_sim_stuck_bits(address, bits, count);
+	}
+}
+
+void hal_sim_stuck_bits(uint32_t address, uint8_t bits, uint32_t count)
+{
+	if (fault_cnt < SIM_FAULT_CNT)
+	{
+		faults[fault_cnt].address = address;
+		faults[fault_cnt].bits = bits;
+		faults[fault_cnt].count = count ? count : UINT32_MAX;
+		fault_cnt++;
+	}
+}
+
+void hal_sim_clear_faults(void)
+{
+	fault_cnt = 0;
+}
+
+void hal_sim_on_flash_lock(void (*hook)(void))
+{
+	lock_hook = hook;
+}
+
+void hal_sim_erase_all(void)
+{
+	memset(flash_mem, 0xFF, flash_size);
+}
+
+// time
+
+void hal_sim_use_wall_clock(bool enable)
+{
+	wall_clock = enable;
+}
+
+void hal_sim_advance_ms(uint32_t ms)
+{
+	virtual_ns += (uint64_t)ms * 1000000;
+}
+
+uint64_t hal_sim_now_us(void)
+{
+	return virtual_ns / 1000;
+}
+
+void hal_sim_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+const hal_sim_stats_t *hal_sim_get_stats(void)
+{
+	return &stats;
+}
+
+uint32_t hal_sim_erase_count(uint32_t unit)
+{
+	return unit < hal_sim_erase_unit_count() ? erase_counts[unit] : 0;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	if (wall_clock)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	}
+	return (uint32_t)(virtual_ns / 1000000);
+}
+
+// flash controller
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	flash_locked = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	void (*hook)(void) = lock_hook;
+
+	flash_locked = true;
+	lock_hook = NULL;
+	if (hook)
+	{
+		hook();
+	}
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef erase_unit(uint32_t unit, uint32_t parallelism)
+{
+	if (unit >= hal_sim_erase_unit_count())
+	{
+		return HAL_ERROR;
+	}
+	memset(flash_mem + (hal_sim_erase_unit_base(unit) - hal_sim_flash_base()), 0xFF, unit_size(unit));
+	uint32_t us = erase_time_us(unit, parallelism);
+	virtual_ns += (uint64_t)us * 1000;
+	stats.erase_us += us;
+	stats.erases++;
+	erase_counts[unit]++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError)
+{
+	uint32_t first, count;
+
+	if (flash_locked)
+	{
+		return HAL_ERROR;
+	}
+	*PageError = 0xFFFFFFFFU;
+
+#if defined(STM32F103xB)
+	if (!in_flash(pEraseInit->PageAddress, 1))
+	{
+		return HAL_ERROR;
+	}
+	first = DiskFlash.unit(pEraseInit->PageAddress, NULL, NULL);
+	count = pEraseInit->NbPages;
+#elif DISK_FLASH_SECTORS
+	first = pEraseInit->Sector;
+	count = pEraseInit->NbSectors;
+	program_parallelism = 1U << pEraseInit->VoltageRange; // x8 << range
+#else
+	first = pEraseInit->Page;
+	count = pEraseInit->NbPages;
+#endif
+	if (pEraseInit->TypeErase == FLASH_TYPEERASE_MASSERASE)
+	{
+		first = 0;
+		count = hal_sim_erase_unit_count();
+	}
+
+	for (uint32_t unit = first; unit < first + count; unit++)
+	{
+		if (erase_unit(unit, program_parallelism) != HAL_OK)
+		{
+#if defined(STM32F103xB)
+			*PageError = hal_sim_erase_unit_base(unit);
+#else
+			*PageError = unit;
+#endif
+			return HAL_ERROR;
+		}
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	uint32_t len;
+
+	switch (TypeProgram)
+	{
+	case FLASH_TYPEPROGRAM_BYTE:
+		len = 1;
+		break;
+	case FLASH_TYPEPROGRAM_HALFWORD:
+		len = 2;
+		break;
+	case FLASH_TYPEPROGRAM_WORD:
+		len = 4;
+		break;
+	case FLASH_TYPEPROGRAM_DOUBLEWORD:
+		len = 8;
+		break;
+	default:
+		return HAL_ERROR;
+	}
+	// Native widths only, up to the parallelism (F4 PGPERR); the F1 HAL splits wider ones
+	const disk_flash_geometry_t *g = geometry();
+#if defined(STM32F103xB)
+	if (len == 1)
+#else
+	if (!g->program_ns[width_index(len)] || len > program_parallelism)
+#endif
+	{
+		return HAL_ERROR;
+	}
+	if (flash_locked || !in_flash(Address, len) || (Address & (len - 1)))
+	{
+		return HAL_ERROR;
+	}
+
+	uint8_t *dst = flash_mem + (Address - hal_sim_flash_base());
+	const uint8_t *src = (const uint8_t *)&Data;
+	bool erased = true;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		erased = erased && dst[i] == 0xFF;
+	}
+	if (!erased)
+	{
+		// F1 (PGERR) and L4/G0 (PROGERR) leave the cell alone unless the new value is all zeros
+		if (g->overwrite == DISK_FLASH_OVERWRITE_ZERO && Data != 0)
+		{
+			stats.rejected_programs++;
+			return HAL_ERROR;
+		}
+		stats.overwrites++;
+	}
+
+	// Programming can only clear bits; the F4 happily ANDs over a non-erased cell
+	for (uint32_t i = 0; i < len; i++)
+	{
+		dst[i] &= src[i];
+	}
+	// A worn cell keeps its stuck bits, and the controller still reports success
+	for (uint32_t f = 0; f < fault_cnt; f++)
+	{
+		uint32_t offset = faults[f].address - Address;
+		if (offset < len && faults[f].count != 0)
+		{
+			dst[offset] |= faults[f].bits;
+			faults[f].count -= faults[f].count != UINT32_MAX;
+		}
+	}
+	uint64_t ns = program_time_ns(len, program_parallelism);
+	virtual_ns += ns;
+	stats.program_ns += ns;
+	stats.programs++;
+	stats.bytes_programmed += len;
+	return HAL_OK;
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_common.h"
+
+// sample configuration
+
+static int brightness = 50;
+static int volume = 75;
+static char name[32] = "device";
+static char key[2048] = "";
+
+static bool number_validator(u8 str[])
+{
+	char *end;
+	long val = strtol((char *)str, &end, 10);
+	return end != (char *)str && *end == '\0' && val >= 0 && val <= 100;
+}
+
+static bool name_validator(u8 str[])
+{
+	size_t len = strlen((char *)str);
+	return len > 0 && len < sizeof(name);
+}
+
+static bool key_validator(u8 str[])
+{
+	return strlen((char *)str) < sizeof(key);
+}
+
+static void brightness_updater(u8 str[])
+{
+	brightness = atoi((char *)str);
+}
+
+static void volume_updater(u8 str[])
+{
+	volume = atoi((char *)str);
+}
+
+static void name_updater(u8 str[])
+{
+	snprintf(name, sizeof(name), "%s", (char *)str);
+}
+
+static void key_updater(u8 str[])
+{
+	snprintf(key, sizeof(key), "%s", (char *)str);
+}
+
+static void brightness_printer(char *buffer, size_t buffer_size)
+{
+	snprintf(buffer, buffer_size, "brightness=%d", brightness);
+}
+
+static void volume_printer(char *buffer, size_t buffer_size)
+{
+	snprintf(buffer, buffer_size, "volume=%d", volume);
+}
+
+static void name_printer(char *buffer, size_t buffer_size)
+{
+	snprintf(buffer, buffer_size, "name=%s", name);
+}
+
+static void key_printer(char *buffer, size_t buffer_size)
+{
+	snprintf(buffer, buffer_size, "key=%s", key);
+}
+
+void host_register_entries(void)
+{
+	Disk.register_entry("brightness", "50", "#(0~100)", number_validator, brightness_updater, brightness_printer);
+	Disk.register_entry("volume", "75", "#(0~100)", number_validator, volume_updater, volume_printer);
+	Disk.register_entry("name", "device", "#(text)", name_validator, name_updater, name_printer);
+	Disk.register_entry("key", "", "#(long text)", key_validator, key_updater, key_printer);
+}
+
+// timing
+
+uint64_t host_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void host_settle(void)
+{
+	u32 wait;
+	while ((wait = Disk.next_deadline_ms()) != DISK_NO_DEADLINE)
+	{
+		hal_sim_advance_ms(wait ? wait : 1);
+		Disk.process();
+	}
+}
+
+// minimal FAT12 host
+
+u16 host_fat12_get(const u8 *fat, u16 cluster)
+{
+	u32 offset = cluster + (cluster / 2);
+	u16 value = fat[offset] | (fat[offset + 1] << 8);
+	return (cluster & 1) ? (value >> 4) : (value & 0xFFF);
+}
+
+void host_fat12_set(u8 *fat, u16 cluster, u16 value)
+{
+	u32 offset = cluster + (cluster / 2);
+	if (cluster & 1)
+	{
+		fat[offset] = (fat[offset] & 0x0F) | ((value & 0x0F) << 4);
+		fat[offset + 1] = (value >> 4) & 0xFF;
+	}
+	else
+	{
+		fat[offset] = value & 0xFF;
+		fat[offset + 1] = (fat[offset + 1] & 0xF0) | ((value >> 8) & 0x0F);
+	}
+}
+
+static u8 *find_config_entry(u8 *dir)
+{
+	for (int i = 0; i < HOST_SECTOR_SIZE / 32; i++)
+	{
+		if (memcmp(dir + i * 32, "CONFIG  TXT", 11) == 0)
+		{
+			return dir + i * 32;
+		}
+	}
+	return NULL;
+}
+
+int host_read_config(char *out, size_t cap)
+{
+	u8 dir[HOST_SECTOR_SIZE], fat[HOST_SECTOR_SIZE], sector[HOST_SECTOR_SIZE];
+	u8 *entry;
+	u32 size, done = 0;
+	u16 cluster;
+
+	Disk.Disk_SecRead(dir, HOST_ROOT_SECTOR);
+	Disk.Disk_SecRead(fat, HOST_FAT1_SECTOR);
+	if ((entry = find_config_entry(dir)) == NULL)
+	{
+		return -1;
+	}
+	cluster = entry[0x1A] | (entry[0x1B] << 8);
+	size = entry[0x1C] | (entry[0x1D] << 8) | (entry[0x1E] << 16) | ((u32)entry[0x1F] << 24);
+
+	while (done < size && cluster >= 2 && cluster < 0xFF8)
+	{
+		u32 chunk = size - done < HOST_SECTOR_SIZE ? size - done : HOST_SECTOR_SIZE;
+		Disk.Disk_SecRead(sector, HOST_DATA_SECTOR + cluster - 2);
+		if (done + chunk < cap)
+		{
+			memcpy(out + done, sector, chunk);
+		}
+		done += chunk;
+		cluster = host_fat12_get(fat, cluster);
+	}
+	if (done < cap)
+	{
+		out[done] = '\0';
+	}
+	return (int)done;
+}
+
+void host_save_config(const char *text)
+{
+	u8 dir[HOST_SECTOR_SIZE], fat[HOST_SECTOR_SIZE], sector[HOST_SECTOR_SIZE];
+	u32 size = strlen(text);
+	u32 clusters = (size + HOST_SECTOR_SIZE - 1) / HOST_SECTOR_SIZE;
+	u8 *entry;
+	u16 first;
+
+	Disk.Disk_SecRead(dir, HOST_ROOT_SECTOR);
+	Disk.Disk_SecRead(fat, HOST_FAT1_SECTOR);
+	if ((entry = find_config_entry(dir)) == NULL)
+	{
+		fprintf(stderr, "host_save_config: CONFIG.TXT not found\n");
+		return;
+	}
+	first = entry[0x1A] | (entry[0x1B] << 8);
+	if (first < 2)
+	{
+		first = 2;
+	}
+
+	// Rewrite the chain as one contiguous run from the current start cluster
+	for (u16 c = first; c != 0 && c < 0xFF8;)
+	{
+		u16 next = host_fat12_get(fat, c);
+		host_fat12_set(fat, c, 0);
+		c = next;
+	}
+	for (u32 i = 0; i < clusters; i++)
+	{
+		host_fat12_set(fat, first + i, i + 1 == clusters ? 0xFFF : first + i + 1);
+	}
+
+	for (u32 i = 0; i < clusters; i++)
+	{
+		u32 chunk = size - i * HOST_SECTOR_SIZE;
+		memset(sector, 0, sizeof(sector));
+		memcpy(sector, text + i * HOST_SECTOR_SIZE, chunk < HOST_SECTOR_SIZE ? chunk : HOST_SECTOR_SIZE);
+		Disk.Disk_SecWrite(sector, HOST_DATA_SECTOR + first + i - 2, 1);
+	}
+	Disk.Disk_SecWrite(fat, HOST_FAT1_SECTOR, 1);
+	Disk.Disk_SecWrite(fat, HOST_FAT2_SECTOR, 1);
+
+	entry[0x1A] = first & 0xFF;
+	entry[0x1B] = first >> 8;
+	entry[0x1C] = size & 0xFF;
+	entry[0x1D] = (size >> 8) & 0xFF;
+	entry[0x1E] = (size >> 16) & 0xFF;
+	entry[0x1F] = (size >> 24) & 0xFF;
+	Disk.Disk_SecWrite(dir, HOST_ROOT_SECTOR, 1);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Shared helpers for the host programs: a sample entry set, a minimal FAT12 "host"
+// that reads and saves CONFIG.TXT through Disk_SecRead/Disk_SecWrite, and timing.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "disk.h"
+
+// Library functions with external linkage that are not part of struct disk
+u8 rewrite_dirty_flash_pages(void);
+u8 rewrite_all_flash_pages(void);
+u8 validate_file(u8 *p_file, u16 root_addr);
+u8 *find_file(u8 *pfilename, u16 *pfilelen, u16 *root_addr);
+void read_sector(u8 *pbuffer, u32 disk_addr);
+u8 write_sector(u8 *buff, u32 diskaddr, u32 length);
+
+#define HOST_SECTOR_SIZE 512
+#define HOST_FAT1_SECTOR 8
+#define HOST_FAT2_SECTOR 20
+#define HOST_ROOT_SECTOR 32
+#define HOST_DATA_SECTOR 64
+
+// Registers brightness (0~100), volume (0~100), name (text) and key (long text)
+void host_register_entries(void);
+
+uint64_t host_now_ns(void);
+
+// Reads CONFIG.TXT through the virtual disk; returns its length or -1 when not found
+int host_read_config(char *out, size_t cap);
+
+// Saves CONFIG.TXT in place the way Linux vfat does on sync: data, FAT1, FAT2, directory
+void host_save_config(const char *text);
+
+// Advances the virtual clock and pumps Disk.process() until nothing is pending
+void host_settle(void);
+
+u16 host_fat12_get(const u8 *fat, u16 cluster);
+void host_fat12_set(u8 *fat, u16 cluster, u16 value);
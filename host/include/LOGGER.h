@@ -0,0 +1,21 @@
+#pragma once
+
+// Host build logger: messages at or above the level named by the DISK_LOG environment
+// variable (trace, debug, info, warn, error; default warn) are printed to stderr.
+
+enum
+{
+	HOST_LOG_TRACE,
+	HOST_LOG_DEBUG,
+	HOST_LOG_INFO,
+	HOST_LOG_WARN,
+	HOST_LOG_ERROR
+};
+
+void host_log(int level, const char *func, const char *fmt, ...);
+
+#define app_log_trace(fmt, ...) host_log(HOST_LOG_TRACE, __func__, fmt, ##__VA_ARGS__)
+#define app_log_debug(fmt, ...) host_log(HOST_LOG_DEBUG, __func__, fmt, ##__VA_ARGS__)
+#define app_log_info(fmt, ...) host_log(HOST_LOG_INFO, __func__, fmt, ##__VA_ARGS__)
+#define app_log_warn(fmt, ...) host_log(HOST_LOG_WARN, __func__, fmt, ##__VA_ARGS__)
+#define app_log_error(fmt, ...) host_log(HOST_LOG_ERROR, __func__, fmt, ##__VA_ARGS__)
@@ -0,0 +1,92 @@
+#pragma once
+
+// Host stand-in for the parts of the STM32 HAL used by the library.
+// Included through host/include/stm32f1xx_hal.h, stm32f4xx_hal.h, stm32l4xx_hal.h or
+// stm32g0xx_hal.h, which add the family specific erase structure and constants first.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define UNUSED(X) (void)X
+
+#define SET_BIT(REG, BIT) ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT) ((REG) & (BIT))
+
+typedef struct
+{
+	volatile uint32_t CR;
+	volatile uint32_t SR;
+} FLASH_TypeDef;
+
+extern FLASH_TypeDef hal_sim_flash_regs;
+#define FLASH (&hal_sim_flash_regs)
+#define FLASH_CR_PG (1U << 0)
+
+#define FLASH_TYPEPROGRAM_BYTE 0x00U
+#define FLASH_TYPEPROGRAM_HALFWORD 0x01U
+#define FLASH_TYPEPROGRAM_WORD 0x02U
+#define FLASH_TYPEPROGRAM_DOUBLEWORD 0x03U
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
+uint32_t HAL_GetTick(void);
+
+// Simulator control
+
+// Map the device flash at its real address (0x08000000). When HAL_SIM_FLASH_FILE is set
+// in the environment the flash is backed by that file and survives between runs.
+void hal_sim_init(void);
+void hal_sim_erase_all(void);
+
+// HAL_GetTick() follows a virtual clock unless wall clock mode is enabled.
+// Erase and program operations charge their typical datasheet duration to the virtual clock.
+void hal_sim_use_wall_clock(bool enable);
+void hal_sim_advance_ms(uint32_t ms);
+uint64_t hal_sim_now_us(void);
+
+// Flash controller counters since the last hal_sim_reset_stats()
+typedef struct
+{
+	uint32_t erases;            // erase units erased
+	uint64_t erase_us;          // time spent erasing
+	uint32_t programs;          // program operations
+	uint32_t bytes_programmed;
+	uint64_t program_ns;        // time spent programming
+	uint32_t rejected_programs; // refused because the target was not erased (F1 PGERR)
+	uint32_t overwrites;        // programmed over non-erased bits (F4 ANDs them in silently)
+} hal_sim_stats_t;
+
+void hal_sim_reset_stats(void);
+const hal_sim_stats_t *hal_sim_get_stats(void);
+// Lifetime erase cycles of one erase unit (kept across hal_sim_reset_stats())
+uint32_t hal_sim_erase_count(uint32_t unit);
+
+// Fault injection: the byte at address keeps bits at 1 through the next count program
+// operations that cover it (0 = for good), while the program still reports success, like
+// a worn cell. HAL_SIM_STUCK=<address>[:<bits>[:<count>]] sets one from the environment.
+void hal_sim_stuck_bits(uint32_t address, uint8_t bits, uint32_t count);
+void hal_sim_clear_faults(void);
+
+// Call hook once, at the next HAL_FLASH_Lock(), like a USB interrupt landing after a
+// commit has programmed flash but before it returns
+void hal_sim_on_flash_lock(void (*hook)(void));
+
+// Device flash geometry
+uint32_t hal_sim_flash_base(void);
+uint32_t hal_sim_flash_size(void);
+uint32_t hal_sim_erase_unit_count(void);
+uint32_t hal_sim_erase_unit_base(uint32_t unit);
+uint32_t hal_sim_erase_unit_size(uint32_t unit);
+const char *hal_sim_device_name(void);
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host build: STM32F1 flash HAL subset, backed by the simulator in host/hal_sim.c
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t PageAddress;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_PAGES 0x00U
+#define FLASH_TYPEERASE_MASSERASE 0x02U
+#define FLASH_BANK_1 1U
+
+#include "hal_sim.h"
@@ -0,0 +1,34 @@
+#pragma once
+
+// Host build: STM32F4 flash HAL subset, backed by the simulator in host/hal_sim.c
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_SECTORS 0x00U
+#define FLASH_TYPEERASE_MASSERASE 0x01U
+#define FLASH_BANK_1 1U
+
+#define FLASH_VOLTAGE_RANGE_1 0x00U // 1.8V - 2.1V, byte parallelism
+#define FLASH_VOLTAGE_RANGE_2 0x01U // 2.1V - 2.7V, half-word parallelism
+#define FLASH_VOLTAGE_RANGE_3 0x02U // 2.7V - 3.6V, word parallelism
+#define FLASH_VOLTAGE_RANGE_4 0x03U // 2.7V - 3.6V + Vpp, double-word parallelism
+
+#define FLASH_SECTOR_0 0U
+#define FLASH_SECTOR_1 1U
+#define FLASH_SECTOR_2 2U
+#define FLASH_SECTOR_3 3U
+#define FLASH_SECTOR_4 4U
+#define FLASH_SECTOR_5 5U
+#define FLASH_SECTOR_6 6U
+#define FLASH_SECTOR_7 7U
+
+#include "hal_sim.h"
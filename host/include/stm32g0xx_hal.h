@@ -0,0 +1,17 @@
+#pragma once
+
+// Host build: STM32G0 flash HAL subset, backed by the simulator in host/hal_sim.c
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Page;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_PAGES 0x02U
+#define FLASH_TYPEERASE_MASSERASE 0x04U
+
+#include "hal_sim.h"
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host build: STM32L4 flash HAL subset, backed by the simulator in host/hal_sim.c
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Page;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_PAGES 0x00U
+#define FLASH_TYPEERASE_MASSERASE 0x01U
+#define FLASH_BANK_1 1U
+
+#include "hal_sim.h"
@@ -0,0 +1,42 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LOGGER.h"
+
+static int log_threshold = -1;
+
+static int threshold(void)
+{
+	static const char *names[] = {"trace", "debug", "info", "warn", "error"};
+	if (log_threshold < 0)
+	{
+		const char *env = getenv("DISK_LOG");
+		log_threshold = HOST_LOG_WARN;
+		for (int i = 0; env && i < (int)(sizeof(names) / sizeof(names[0])); i++)
+		{
+			if (strcmp(env, names[i]) == 0)
+			{
+				log_threshold = i;
+			}
+		}
+	}
+	return log_threshold;
+}
+
+void host_log(int level, const char *func, const char *fmt, ...)
+{
+	static const char tags[] = "TDIWE";
+	va_list args;
+
+	if (level < threshold())
+	{
+		return;
+	}
+	fprintf(stderr, "[%c] %s: ", tags[level], func);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
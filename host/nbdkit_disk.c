@@ -0,0 +1,259 @@
+// nbdkit plugin serving the virtual disk, so the Linux vfat driver (and editors, dd, fio)
+// can run against the library without hardware:
+//
+//   make nbdkit
+//   nbdkit -f -v build/f411/nbdkit-stm32disk-plugin.so flash=/tmp/flash.bin
+//   sudo nbd-client -b 512 localhost /dev/nbd0 && sudo mount -t vfat -o flush /dev/nbd0 /mnt
+//
+// Parameters: flash=<file> keeps the simulated flash between runs, pump_ms=<n> sets how
+// often Disk.process() is pumped (default 10). NBD flush requests commit immediately.
+// Per-request library cost is printed when the plugin unloads.
+
+#define NBDKIT_API_VERSION 2
+#include <nbdkit-plugin.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_common.h"
+
+#define SECTOR_SIZE HOST_SECTOR_SIZE
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sectors;
+	uint64_t ns;
+	uint64_t max_ns;
+} req_stats_t;
+
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t pump_thread;
+static volatile bool pump_running;
+static unsigned pump_ms = 10;
+static req_stats_t read_stats, write_stats, commit_stats;
+
+static void account(req_stats_t *st, uint64_t t0, uint32_t sectors)
+{
+	uint64_t ns = host_now_ns() - t0;
+	st->count++;
+	st->sectors += sectors;
+	st->ns += ns;
+	st->max_ns = ns > st->max_ns ? ns : st->max_ns;
+}
+
+static void *pump(void *arg)
+{
+	struct timespec delay = {pump_ms / 1000, (pump_ms % 1000) * 1000000L};
+	(void)arg;
+
+	while (pump_running)
+	{
+		nanosleep(&delay, NULL);
+		pthread_mutex_lock(&disk_lock);
+		if (Disk.next_deadline_ms() == 0)
+		{
+			uint64_t t0 = host_now_ns();
+			Disk.process();
+			account(&commit_stats, t0, 0);
+		}
+		pthread_mutex_unlock(&disk_lock);
+	}
+	return NULL;
+}
+
+static int disk_config(const char *key, const char *value)
+{
+	if (strcmp(key, "flash") == 0)
+	{
+		setenv("HAL_SIM_FLASH_FILE", value, 1);
+	}
+	else if (strcmp(key, "pump_ms") == 0)
+	{
+		pump_ms = atoi(value) > 0 ? atoi(value) : 10;
+	}
+	else
+	{
+		nbdkit_error("unknown parameter '%s'", key);
+		return -1;
+	}
+	return 0;
+}
+
+static int disk_get_ready(void)
+{
+	hal_sim_init();
+	hal_sim_use_wall_clock(true);
+	host_register_entries();
+	Disk.init();
+	return 0;
+}
+
+static int disk_after_fork(void)
+{
+	pump_running = true;
+	if (pthread_create(&pump_thread, NULL, pump, NULL) != 0)
+	{
+		nbdkit_error("cannot start the process() pump thread");
+		return -1;
+	}
+	return 0;
+}
+
+static void print_stats(const char *label, const req_stats_t *st)
+{
+	if (st->count == 0)
+	{
+		return;
+	}
+	fprintf(stderr, "  %-8s %8llu requests  mean %9.1f us  max %9.1f us", label, (unsigned long long)st->count,
+			st->ns / 1e3 / st->count, st->max_ns / 1e3);
+	if (st->sectors)
+	{
+		fprintf(stderr, "  %10llu sectors %9.1f ns/sector", (unsigned long long)st->sectors,
+				(double)st->ns / st->sectors);
+	}
+	fprintf(stderr, "\n");
+}
+
+static void disk_unload(void)
+{
+	if (pump_running)
+	{
+		pump_running = false;
+		pthread_join(pump_thread, NULL);
+	}
+	Disk.flush();
+	fprintf(stderr, "stm32disk (%s) library cost per request:\n", hal_sim_device_name());
+	print_stats("read", &read_stats);
+	print_stats("write", &write_stats);
+	print_stats("commit", &commit_stats);
+}
+
+static void *disk_open(int readonly)
+{
+	static int handle;
+	(void)readonly;
+	return &handle;
+}
+
+static int64_t disk_get_size(void *handle)
+{
+	(void)handle;
+	return (int64_t)Disk.get_sector_count() * SECTOR_SIZE;
+}
+
+static int disk_pread(void *handle, void *buf, uint32_t count, uint64_t offset, uint32_t flags)
+{
+	u8 sector[SECTOR_SIZE];
+	u8 *out = buf;
+	(void)handle;
+	(void)flags;
+
+	pthread_mutex_lock(&disk_lock);
+	uint64_t t0 = host_now_ns();
+	while (count)
+	{
+		u32 lba = offset / SECTOR_SIZE;
+		u32 skip = offset % SECTOR_SIZE;
+		u32 n = SECTOR_SIZE - skip < count ? SECTOR_SIZE - skip : count;
+		if (skip == 0 && n == SECTOR_SIZE)
+		{
+			Disk.Disk_SecRead(out, lba);
+		}
+		else
+		{
+			Disk.Disk_SecRead(sector, lba);
+			memcpy(out, sector + skip, n);
+		}
+		out += n;
+		offset += n;
+		count -= n;
+	}
+	account(&read_stats, t0, (uint32_t)((out - (u8 *)buf + SECTOR_SIZE - 1) / SECTOR_SIZE));
+	pthread_mutex_unlock(&disk_lock);
+	return 0;
+}
+
+static int disk_pwrite(void *handle, const void *buf, uint32_t count, uint64_t offset, uint32_t flags)
+{
+	u8 sector[SECTOR_SIZE];
+	const u8 *in = buf;
+	uint32_t total = count;
+	(void)handle;
+
+	pthread_mutex_lock(&disk_lock);
+	uint64_t t0 = host_now_ns();
+	while (count)
+	{
+		u32 lba = offset / SECTOR_SIZE;
+		u32 skip = offset % SECTOR_SIZE;
+		u32 n = SECTOR_SIZE - skip < count ? SECTOR_SIZE - skip : count;
+		// Disk_SecWrite takes a non-const buffer, always hand it a private copy
+		if (skip || n != SECTOR_SIZE)
+		{
+			Disk.Disk_SecRead(sector, lba);
+		}
+		memcpy(sector + skip, in, n);
+		Disk.Disk_SecWrite(sector, lba, 1);
+		in += n;
+		offset += n;
+		count -= n;
+	}
+	account(&write_stats, t0, (total + SECTOR_SIZE - 1) / SECTOR_SIZE);
+	if (flags & NBDKIT_FLAG_FUA)
+	{
+		Disk.flush();
+	}
+	pthread_mutex_unlock(&disk_lock);
+	return 0;
+}
+
+static int disk_flush(void *handle, uint32_t flags)
+{
+	(void)handle;
+	(void)flags;
+	pthread_mutex_lock(&disk_lock);
+	uint64_t t0 = host_now_ns();
+	Disk.flush();
+	account(&commit_stats, t0, 0);
+	pthread_mutex_unlock(&disk_lock);
+	return 0;
+}
+
+static int disk_can_fua(void *handle)
+{
+	(void)handle;
+	return NBDKIT_FUA_NATIVE;
+}
+
+static int disk_can_flush(void *handle)
+{
+	(void)handle;
+	return 1;
+}
+
+static struct nbdkit_plugin plugin = {
+	.name = "stm32disk",
+	.longname = "STM32 USB mass storage virtual disk",
+	.description = "Serves the library's virtual FAT12 disk on a simulated STM32 flash",
+	.config = disk_config,
+	.config_help = "flash=<FILE>     keep the simulated flash in FILE\n"
+				   "pump_ms=<N>      Disk.process() period in ms (default 10)",
+	.get_ready = disk_get_ready,
+	.after_fork = disk_after_fork,
+	.unload = disk_unload,
+	.open = disk_open,
+	.get_size = disk_get_size,
+	.pread = disk_pread,
+	.pwrite = disk_pwrite,
+	.flush = disk_flush,
+	.can_flush = disk_can_flush,
+	.can_fua = disk_can_fua,
+};
+
+#define THREAD_MODEL NBDKIT_THREAD_MODEL_SERIALIZE_ALL_REQUESTS
+NBDKIT_REGISTER_PLUGIN(plugin)
@@ -0,0 +1,429 @@
+// Replays host write traces through Disk_SecWrite/Disk_SecRead/process on the simulator and
+// reports, per save, time to persist, commits, erases, bytes programmed and the erases done
+// ahead of the next commit (DISK_ERASE_AHEAD_MS), then checks the CONFIG.TXT that survives
+// a reboot.
+//
+// Usage: replay <trace>...
+// Built with TRACE=1, the binary event trace is written to $DISK_TRACE_FILE (see tracedump).
+//
+// Trace format, one command per line ('#' starts a comment line):
+//   T <ms>                  host idle for <ms>; Disk.process() is pumped every millisecond
+//   R <lba> [count]         host reads sectors
+//   W <lba> [count]         host writes sectors; payload lines follow until "end":
+//     fill <hex>              fill the whole write with a byte (default 00)
+//     @<offset> <items>       place hex bytes and "quoted strings" (\r \n \t \\ \" \xHH)
+//     dirent <slot> "<8.3 name, 11 chars>" <attr hex> <cluster> <size>
+//     fat12 <cluster> <value hex>
+//   S <label>               start of a save; statistics are reported per save
+//   X "<text>"              text that must appear in CONFIG.TXT after the final reboot
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk_trace.h"
+#include "host_common.h"
+
+#define MAX_WRITE_SECTORS 16
+#define MAX_SAVES 32
+#define MAX_EXPECT 16
+
+typedef struct
+{
+	char label[48];
+	u32 writes;
+	u32 commits;
+	u32 erases;
+	u32 ahead_erases; // done by erase-ahead after the save's commit
+	u32 bytes;
+	uint64_t first_write_us;
+	uint64_t persisted_us; // end of the last commit after the save's last write
+	uint64_t last_write_us;
+} save_stats_t;
+
+static save_stats_t saves[MAX_SAVES];
+static int save_cnt;
+static char expect[MAX_EXPECT][256];
+static int expect_cnt;
+static u8 wbuf[MAX_WRITE_SECTORS * HOST_SECTOR_SIZE];
+static char text[8192];
+static const char *trace_name;
+static int line_no;
+static bool host_wrote; // since the last commit
+
+static void fail(const char *msg)
+{
+	fprintf(stderr, "%s:%d: %s\n", trace_name, line_no, msg);
+	exit(2);
+}
+
+static save_stats_t *current_save(void)
+{
+	return save_cnt ? &saves[save_cnt - 1] : NULL;
+}
+
+// Runs process(), attributing any commit to the current save. At the deadline it runs
+// until nothing more is due, so updates run ahead of the commit (DISK_UPDATE_STEPS) count
+// with it. Work due without a host write since the last commit is erase-ahead
+// (DISK_ERASE_AHEAD_MS), counted apart. Before the deadline process() only validates
+// ahead (DISK_VALIDATE_AHEAD).
+static void pump(void)
+{
+	save_stats_t *sv = current_save();
+	if (Disk.next_deadline_ms() != 0)
+	{
+		Disk.process();
+		return;
+	}
+	hal_sim_stats_t before = *hal_sim_get_stats();
+	do
+	{
+		Disk.process();
+	} while (Disk.next_deadline_ms() == 0);
+	const hal_sim_stats_t *after = hal_sim_get_stats();
+	if (sv && !host_wrote)
+	{
+		sv->ahead_erases += after->erases - before.erases;
+	}
+	else if (sv)
+	{
+		sv->commits++;
+		sv->erases += after->erases - before.erases;
+		sv->bytes += after->bytes_programmed - before.bytes_programmed;
+		if (sv->writes)
+		{
+			sv->persisted_us = hal_sim_now_us();
+		}
+	}
+	host_wrote = false;
+}
+
+static void idle(u32 ms)
+{
+	for (u32 i = 0; i < ms; i++)
+	{
+		hal_sim_advance_ms(1);
+		pump();
+	}
+}
+
+// Parses a quoted string starting at *p into out, returns length
+static size_t parse_string(char **p, u8 *out, size_t cap)
+{
+	char *s = *p + 1;
+	size_t n = 0;
+	while (*s && *s != '"')
+	{
+		u8 c = *s++;
+		if (c == '\\')
+		{
+			switch (*s++)
+			{
+			case 'r': c = '\r'; break;
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			case '0': c = 0; break;
+			case 'x':
+				c = (u8)strtoul((char[]){s[0], s[1], 0}, NULL, 16);
+				s += 2;
+				break;
+			default: c = s[-1]; break;
+			}
+		}
+		if (n >= cap)
+		{
+			fail("string too long");
+		}
+		out[n++] = c;
+	}
+	if (*s != '"')
+	{
+		fail("unterminated string");
+	}
+	*p = s + 1;
+	return n;
+}
+
+static char *skip_ws(char *p)
+{
+	while (*p && isspace((unsigned char)*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+static void parse_payload_line(char *p, u32 len)
+{
+	if (strncmp(p, "fill", 4) == 0)
+	{
+		memset(wbuf, (int)strtoul(p + 4, NULL, 16), len);
+	}
+	else if (*p == '@')
+	{
+		u32 off = strtoul(p + 1, &p, 0);
+		for (p = skip_ws(p); *p; p = skip_ws(p))
+		{
+			if (*p == '"')
+			{
+				u8 tmp[1024];
+				size_t n = parse_string(&p, tmp, sizeof(tmp));
+				if (off + n > len)
+				{
+					fail("payload overflows write");
+				}
+				memcpy(wbuf + off, tmp, n);
+				off += n;
+			}
+			else
+			{
+				if (off >= len)
+				{
+					fail("payload overflows write");
+				}
+				wbuf[off++] = (u8)strtoul(p, &p, 16);
+			}
+		}
+	}
+	else if (strncmp(p, "dirent", 6) == 0)
+	{
+		u8 name[16];
+		u32 slot = strtoul(p + 6, &p, 0);
+		p = skip_ws(p);
+		if (*p != '"' || parse_string(&p, name, sizeof(name)) != 11)
+		{
+			fail("dirent name must be 11 characters");
+		}
+		u32 attr = strtoul(p, &p, 16);
+		u32 cluster = strtoul(p, &p, 0);
+		u32 size = strtoul(p, &p, 0);
+		u8 *e = wbuf + slot * 32;
+		if ((slot + 1) * 32 > len)
+		{
+			fail("dirent outside write");
+		}
+		memset(e, 0, 32);
+		memcpy(e, name, 11);
+		e[0x0B] = attr;
+		e[0x1A] = cluster & 0xFF;
+		e[0x1B] = cluster >> 8;
+		e[0x1C] = size & 0xFF;
+		e[0x1D] = (size >> 8) & 0xFF;
+		e[0x1E] = (size >> 16) & 0xFF;
+		e[0x1F] = size >> 24;
+	}
+	else if (strncmp(p, "fat12", 5) == 0)
+	{
+		u32 cluster = strtoul(p + 5, &p, 0);
+		u32 value = strtoul(p, &p, 16);
+		if (cluster + cluster / 2 + 1 >= len)
+		{
+			fail("fat12 entry outside write");
+		}
+		host_fat12_set(wbuf, cluster, value);
+	}
+	else
+	{
+		fail("unknown payload line");
+	}
+}
+
+static void replay(FILE *f)
+{
+	char line[2048];
+	u8 sector[HOST_SECTOR_SIZE];
+
+	while (fgets(line, sizeof(line), f))
+	{
+		line_no++;
+		char *p = skip_ws(line);
+		line[strcspn(line, "\r\n")] = '\0';
+		if (*p == '\0' || *p == '#')
+		{
+			continue;
+		}
+		char cmd = *p++;
+		switch (cmd)
+		{
+		case 'T':
+			idle(strtoul(p, NULL, 0));
+			break;
+		case 'R':
+		{
+			u32 lba = strtoul(p, &p, 0);
+			u32 count = strtoul(p, &p, 0);
+			for (u32 i = 0; i < (count ? count : 1); i++)
+			{
+				Disk.Disk_SecRead(sector, lba + i);
+			}
+			break;
+		}
+		case 'W':
+		{
+			u32 lba = strtoul(p, &p, 0);
+			u32 count = strtoul(p, &p, 0);
+			count = count ? count : 1;
+			if (count > MAX_WRITE_SECTORS)
+			{
+				fail("write too long");
+			}
+			memset(wbuf, 0, sizeof(wbuf));
+			while (fgets(line, sizeof(line), f))
+			{
+				line_no++;
+				line[strcspn(line, "\r\n")] = '\0';
+				p = skip_ws(line);
+				if (strcmp(p, "end") == 0)
+				{
+					break;
+				}
+				if (*p && *p != '#')
+				{
+					parse_payload_line(p, count * HOST_SECTOR_SIZE);
+				}
+			}
+			save_stats_t *sv = current_save();
+			if (sv)
+			{
+				if (sv->writes++ == 0)
+				{
+					sv->first_write_us = hal_sim_now_us();
+				}
+				sv->last_write_us = hal_sim_now_us();
+				sv->persisted_us = 0;
+			}
+			Disk.Disk_SecWrite(wbuf, lba, count);
+			host_wrote = true;
+			break;
+		}
+		case 'S':
+			if (save_cnt == MAX_SAVES)
+			{
+				fail("too many saves");
+			}
+			memset(&saves[save_cnt], 0, sizeof(saves[0]));
+			snprintf(saves[save_cnt].label, sizeof(saves[0].label), "%s", skip_ws(p));
+			save_cnt++;
+			break;
+		case 'X':
+		{
+			p = skip_ws(p);
+			if (*p != '"' || expect_cnt == MAX_EXPECT)
+			{
+				fail("bad expectation");
+			}
+			size_t n = parse_string(&p, (u8 *)expect[expect_cnt], sizeof(expect[0]) - 1);
+			expect[expect_cnt++][n] = '\0';
+			break;
+		}
+		default:
+			fail("unknown command");
+		}
+	}
+}
+
+static int run_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	int failures = 0;
+
+	if (!f)
+	{
+		perror(path);
+		return 1;
+	}
+	trace_name = path;
+	line_no = 0;
+	save_cnt = 0;
+	expect_cnt = 0;
+
+	// Fresh device: blank user region, defaults committed before the host mounts
+	hal_sim_erase_all();
+	Disk.load_from_flash();
+	Disk.init();
+	host_settle();
+	hal_sim_reset_stats();
+	host_wrote = false;
+
+	replay(f);
+	fclose(f);
+	idle(10000); // let the last save settle
+
+	printf("%s (%s)\n", path, hal_sim_device_name());
+	printf("  %-30s %6s %8s %11s %7s %9s %6s\n", "save", "writes", "commits", "persist ms", "erases", "bytes",
+		   "ahead");
+	for (int i = 0; i < save_cnt; i++)
+	{
+		save_stats_t *sv = &saves[i];
+		if (sv->persisted_us)
+		{
+			printf("  %-30s %6lu %8lu %11.1f %7lu %9lu %6lu\n", sv->label, (unsigned long)sv->writes,
+				   (unsigned long)sv->commits, (sv->persisted_us - sv->first_write_us) / 1000.0,
+				   (unsigned long)sv->erases, (unsigned long)sv->bytes, (unsigned long)sv->ahead_erases);
+		}
+		else
+		{
+			printf("  %-30s %6lu %8lu %11s %7lu %9lu %6lu\n", sv->label, (unsigned long)sv->writes,
+				   (unsigned long)sv->commits, "never", (unsigned long)sv->erases, (unsigned long)sv->bytes,
+				   (unsigned long)sv->ahead_erases);
+			failures++;
+		}
+	}
+
+	// Reboot and check what the device actually kept
+	Disk.load_from_flash();
+	Disk.init();
+	host_settle();
+	if (host_read_config(text, sizeof(text)) < 0)
+	{
+		printf("  CONFIG.TXT missing after reboot\n");
+		return failures + 1;
+	}
+	for (int i = 0; i < expect_cnt; i++)
+	{
+		if (strstr(text, expect[i]) == NULL)
+		{
+			printf("  after reboot: missing \"%s\"\n", expect[i]);
+			failures++;
+		}
+	}
+	printf("  CONFIG.TXT after reboot: %s\n", failures ? "WRONG" : "ok");
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <trace>...\n", argv[0]);
+		return 2;
+	}
+	hal_sim_init();
+	host_register_entries();
+	DiskTrace.init();
+	for (int i = 1; i < argc; i++)
+	{
+		failures += run_trace(argv[i]) != 0;
+	}
+
+	const char *trace_file = getenv("DISK_TRACE_FILE");
+	if (DISK_TRACE && trace_file)
+	{
+		static u8 buf[sizeof(disk_trace_header_t) + DISK_TRACE_DEPTH * sizeof(disk_trace_rec_t)];
+		u32 len = DiskTrace.export(buf, sizeof(buf));
+		FILE *f = fopen(trace_file, "wb");
+		if (!f || fwrite(buf, 1, len, f) != len)
+		{
+			perror(trace_file);
+			failures++;
+		}
+		if (f)
+		{
+			fclose(f);
+		}
+	}
+	return failures ? 1 : 0;
+}
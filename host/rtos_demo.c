@@ -0,0 +1,67 @@
+// Runs DiskRtos on the FreeRTOS POSIX port: a "host" task saves CONFIG.TXT, the commit
+// task must persist it once the debounce timer expires, and stay blocked otherwise.
+// Build with: make rtos FREERTOS_KERNEL=<path to FreeRTOS-Kernel>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "disk_rtos.h"
+#include "host_common.h"
+
+static char text[8192];
+
+static void host_task(void *arg)
+{
+	int failures = 0;
+	(void)arg;
+
+	// Let the defaults from Disk.init() commit first
+	vTaskDelay(pdMS_TO_TICKS(FLASH_WRITE_DELAY_MS * 2));
+
+	host_save_config("brightness=33\r\nvolume=44\r\nname=rtos\r\n");
+	TickType_t saved = xTaskGetTickCount();
+	if (Disk.next_deadline_ms() == DISK_NO_DEADLINE)
+	{
+		printf("  save did not arm a commit\n");
+		failures++;
+	}
+
+	// Poll (the demo, not the library) until the commit task has drained the write
+	while (Disk.next_deadline_ms() != DISK_NO_DEADLINE && xTaskGetTickCount() - saved < pdMS_TO_TICKS(5000))
+	{
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	printf("  committed %lu ms after the save\n", (unsigned long)(xTaskGetTickCount() - saved) * portTICK_PERIOD_MS);
+
+	Disk.load_from_flash();
+	Disk.init();
+	host_read_config(text, sizeof(text));
+	if (strstr(text, "brightness=33\t") == NULL || strstr(text, "name=rtos\t") == NULL)
+	{
+		printf("  flash does not hold the saved values\n");
+		failures++;
+	}
+	printf("  rtos demo: %s\n", failures ? "FAILED" : "ok");
+	exit(failures ? 1 : 0);
+}
+
+int main(void)
+{
+	hal_sim_init();
+	hal_sim_use_wall_clock(true);
+	host_register_entries();
+	Disk.init();
+	printf("%s on FreeRTOS POSIX port\n", hal_sim_device_name());
+
+	if (!DiskRtos.start())
+	{
+		return 1;
+	}
+	xTaskCreate(host_task, "host", configMINIMAL_STACK_SIZE * 4, NULL, tskIDLE_PRIORITY + 2, NULL);
+	vTaskStartScheduler();
+	return 1;
+}
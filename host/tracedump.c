@@ -0,0 +1,97 @@
+// Decodes a DiskTrace.export() buffer into text or Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev). Event names and formats come from DISK_TRACE_EVENTS in disk_trace.h,
+// so they only exist here, not in the firmware.
+//
+// Usage: tracedump [--json] <trace.bin>
+//
+// On target, export with DiskTrace.export() and ship the bytes over any channel, or dump
+// them with the debugger. On the host, replay writes $DISK_TRACE_FILE when built with TRACE=1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk_trace.h"
+
+typedef struct
+{
+	char phase;
+	const char *name;
+	const char *format;
+} event_info_t;
+
+#define EVENT_INFO(id, phase, name, format) {phase, name, format},
+static const event_info_t events[DISK_TRACE_EVENT_CNT] = {DISK_TRACE_EVENTS(EVENT_INFO)};
+
+int main(int argc, char **argv)
+{
+	bool json = argc == 3 && strcmp(argv[1], "--json") == 0;
+	disk_trace_header_t header;
+	disk_trace_rec_t rec;
+	char text[160];
+
+	if (argc != 2 && !json)
+	{
+		fprintf(stderr, "usage: %s [--json] <trace.bin>\n", argv[0]);
+		return 2;
+	}
+	FILE *f = fopen(argv[argc - 1], "rb");
+	if (!f)
+	{
+		perror(argv[argc - 1]);
+		return 1;
+	}
+	if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != DISK_TRACE_MAGIC || header.ticks_per_us == 0)
+	{
+		fprintf(stderr, "%s: not a disk trace\n", argv[argc - 1]);
+		return 1;
+	}
+
+	if (json)
+	{
+		printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	}
+	else
+	{
+		printf("# %lu events, %lu dropped, %lu ticks/us\n", (unsigned long)header.count,
+			   (unsigned long)header.dropped, (unsigned long)header.ticks_per_us);
+	}
+
+	// Timestamps are free-running 32-bit ticks, accumulate deltas so wraps do not matter
+	uint64_t ticks = 0;
+	u32 last = 0;
+	for (u32 i = 0; i < header.count && fread(&rec, sizeof(rec), 1, f) == 1; i++)
+	{
+		ticks += i ? (u32)(rec.timestamp - last) : 0;
+		last = rec.timestamp;
+		double us = (double)ticks / header.ticks_per_us;
+
+		const event_info_t *ev = rec.event < DISK_TRACE_EVENT_CNT ? &events[rec.event] : NULL;
+		if (ev)
+		{
+			snprintf(text, sizeof(text), ev->format, rec.arg[0], rec.arg[1]);
+		}
+		else
+		{
+			snprintf(text, sizeof(text), "unknown event %lu (%lu, %lu)", (unsigned long)rec.event,
+					 (unsigned long)rec.arg[0], (unsigned long)rec.arg[1]);
+		}
+
+		if (json)
+		{
+			printf("%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":1,%s\"args\":{\"msg\":\"%s\"}}\n",
+				   i ? "," : "", ev ? ev->name : "unknown", ev ? ev->phase : 'i', us,
+				   ev && ev->phase != 'i' ? "" : "\"s\":\"t\",", text);
+		}
+		else
+		{
+			printf("%14.3f us  %c %-14s %s\n", us, ev ? ev->phase : '?', ev ? ev->name : "?", text);
+		}
+	}
+	if (json)
+	{
+		printf("]}\n");
+	}
+	fclose(f);
+	return 0;
+}
@@ -4,19 +4,25 @@
 
 #if defined(STM32F103xB)
 #include "stm32f1xx_hal.h"
-#elif defined(STM32F411xE)
+#elif defined(STM32F401xE) || defined(STM32F411xE) || defined(STM32F446xx)
 #include "stm32f4xx_hal.h"
+#elif defined(STM32L432xx)
+#include "stm32l4xx_hal.h"
+#elif defined(STM32G071xx)
+#include "stm32g0xx_hal.h"
 #endif
-#include "flashpages.h"
+#include "disk_config.h"
 #include "LOGGER.h"
 #include "types.h"
 #include "minmax.h"
 #include "bithelper.h"
 #include <stdbool.h>
+#include "disk_flash.h"
 
 #define MAX_ENTRY_LABEL_LENGTH 64
 #define MAX_ENTRY_VALUE_LENGTH 2048  // For long values like private keys
 #define MAX_ENTRY_COMMENT_LENGTH 64
+#define DISK_NO_DEADLINE 0xFFFFFFFFUL // next_deadline_ms(): nothing pending, sleep until the write hook fires
 
 typedef struct {
 	char entry[MAX_ENTRY_LABEL_LENGTH];
@@ -27,15 +33,54 @@ typedef struct {
 	void(*print)(char *buffer, size_t buffer_size);
 } FILE_ENTRY;
 
+typedef struct {
+	u32 per_hour_milli;  // erase budget in force, erases per 1000 hours; 0 = no budget
+	u32 available;       // whole erases it allows now
+	u32 held;            // commits it held past their delay
+	u32 held_ms;         // total time they were held
+	u32 erases;          // erases since boot
+	u32 units;           // erase units in the user data region
+	u32 endurance;       // erase cycles per unit (flash descriptor)
+	u32 projected_days;  // region lifetime at this session's erase rate, spread over all units; 0 = no erases yet
+} disk_budget_t;
+
+enum {
+	DISK_CALLBACK_VALIDATE,
+	DISK_CALLBACK_UPDATE,
+	DISK_CALLBACK_PRINT,
+	DISK_CALLBACK_KINDS
+};
+
+typedef struct {
+	const char *entry;               // registered name
+	u32 budget_us;                   // per call, 0 = not checked
+	u32 max_us[DISK_CALLBACK_KINDS]; // longest validate, update and print call
+	u32 overruns;                    // calls that took longer than budget_us
+} disk_callback_t;
+
+struct disk_copy_engine; // disk_copy.h
+
 struct disk {
 	void(*init)(void);
 	void(*load_from_flash)(void);
 	void(*process)(void);  // Call from main loop to flush deferred flash writes
+	void(*flush)(void);    // Validate and commit pending writes now, ignoring the delay
+	u32(*next_deadline_ms)(void); // ms until process() has work, 0 if due now, DISK_NO_DEADLINE if idle; a query, changes nothing
+	void(*set_write_hook)(void(*hook)(void)); // Called after every host write (may run in USB IRQ context)
+	void(*set_copy_engine)(const struct disk_copy_engine *engine); // Sector copy engine, NULL = CPU (disk_copy.h)
 	u8(*Disk_SecWrite)(u8* pbuffer, u32 diskaddr, u32 length);
 	void(*Disk_SecRead)(u8* pbuffer, u32 disk_addr);
+	void(*Disk_SecReadMulti)(u8* pbuffer, u32 disk_addr, u32 count); // Consecutive sectors, copies chained on the engine
 	u32(*get_sector_size)(void);
 	u32(*get_sector_count)(void);
 	bool(*register_entry)(char* entry, char* default_val, char* comment, void* validator, void* updater, void* printer);
+	u32(*get_generation)(u32 *oldest); // Number of the last config commit, 0 if none; *oldest: first one restore() can reach
+	u8(*restore)(u32 generation);       // Reinstate the values of an earlier commit as a new commit (DISK_STORE_TLV)
+	u32(*get_wear)(u16 *counts, u32 max); // Lifetime erase cycles per user data page from the F103 page map, returns pages filled
+	void(*eject)(void); // Host ejected the medium or the bus suspended: commit at the next process(), whatever the delay or budget (IRQ safe)
+	void(*get_budget)(disk_budget_t *out); // Erase budget use and the flash lifetime it projects
+	bool(*set_callback_budget)(const char *entry, u32 us); // Per-call budget of one entry's callbacks, 0 = unchecked (DISK_CALLBACK_BUDGET_US)
+	u32(*get_callbacks)(disk_callback_t *out, u32 max);    // Callback timing per registered entry, returns entries filled
 };
 
 extern const struct disk Disk;
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+// Build-time options for the mass storage library.
+// Every option can be overridden from the compiler command line (-DNAME=value).
+
+// Idle time after the last host write before CONFIG.TXT is validated and committed to flash
+#ifndef FLASH_WRITE_DELAY_MS
+#define FLASH_WRITE_DELAY_MS 500
+#endif
+
+// Learn the idle time from the host instead: the delay follows the largest gap the host
+// leaves between the writes of one save (smoothed, plus twice its mean deviation), kept
+// between DISK_DEBOUNCE_MIN_MS and DISK_DEBOUNCE_MAX_MS, starting every session at
+// FLASH_WRITE_DELAY_MS. Writes less than DISK_DEBOUNCE_MAX_MS apart belong to one save, so
+// a host write that soon after a commit the delay fired counts as an early commit and
+// widens the delay (see README, Adaptive Commit Delay).
+#ifndef DISK_DEBOUNCE_ADAPTIVE
+#define DISK_DEBOUNCE_ADAPTIVE 0
+#endif
+
+#ifndef DISK_DEBOUNCE_MIN_MS
+#define DISK_DEBOUNCE_MIN_MS 20
+#endif
+
+#ifndef DISK_DEBOUNCE_MAX_MS
+#define DISK_DEBOUNCE_MAX_MS 1000
+#endif
+
+// Erase budget: commits wait past their delay until it can pay for the erases they will do
+// (the whole region for a log compaction), so saves arriving faster are coalesced in RAM
+// into one commit. Disk.eject() and Disk.flush() commit regardless. DISK_ERASE_BUDGET_PER_HOUR
+// caps the sustained erase rate, with DISK_ERASE_BUDGET_BURST erases in reserve at boot
+// (saving up to the region's erase units); DISK_LIFETIME_YEARS caps it so the region's
+// erase units last that long at the descriptor's endurance. The lower budget applies,
+// 0 = no limit (see README, Erase Budget).
+#ifndef DISK_ERASE_BUDGET_PER_HOUR
+#define DISK_ERASE_BUDGET_PER_HOUR 0
+#endif
+
+#ifndef DISK_ERASE_BUDGET_BURST
+#define DISK_ERASE_BUDGET_BURST 4
+#endif
+
+#ifndef DISK_LIFETIME_YEARS
+#define DISK_LIFETIME_YEARS 0
+#endif
+
+// Synthesize the FAT and root directory on read from a 16-slot file table instead of
+// keeping them in disk_buffer and flash. Only file data is stored and committed.
+#ifndef DISK_META_SYNTH
+#define DISK_META_SYNTH 0
+#endif
+
+// Split CONFIG.TXT into lines and run the validators in Disk.process() as its data sectors
+// land, instead of after the commit delay, so the commit only applies the values. Validators
+// must not have side effects: they may run on content the host overwrites before the commit.
+#ifndef DISK_VALIDATE_AHEAD
+#define DISK_VALIDATE_AHEAD 0
+#endif
+
+// Compressed image log: program the CONFIG.TXT sectors the host has written past into the
+// erased end of the log from Disk.process(), one sector per call, so the commit only
+// programs the rest of the file, the metadata and the record header. Needs DISK_STORE_LOG
+// and DISK_VALIDATE_AHEAD, whose stream tracking it uses (see README, Streaming Commit).
+#ifndef DISK_STREAM_COMMIT
+#define DISK_STREAM_COMMIT 0
+#endif
+
+// Time every validate, update and print callback with the disk_prof.h tick counter (add
+// src/disk_prof.c) and report calls that take longer than their entry's budget: a warning,
+// a trace event and STATS.TXT. The default budget in us per call, Disk.set_callback_budget()
+// sets it per entry. 0 = callbacks are not timed (see README, Callback Budgets).
+#ifndef DISK_CALLBACK_BUDGET_US
+#define DISK_CALLBACK_BUDGET_US 0
+#endif
+
+// Run the update callbacks from Disk.process() instead of inside the validation: a value
+// that changed is queued, and each process() call runs queued updates, at least one, until
+// DISK_UPDATE_SLICE_US is spent. The printer of an entry runs after its update, and the
+// commit waits until the queue is empty, so it still stores the printed values.
+#ifndef DISK_UPDATE_STEPS
+#define DISK_UPDATE_STEPS 0
+#endif
+
+#ifndef DISK_UPDATE_SLICE_US
+#define DISK_UPDATE_SLICE_US 1000
+#endif
+
+// Host idle time after the last write before Disk.process() prepares flash for the next
+// commit: when the log has no room left for another one it is compacted right away, so
+// the next host save only programs. 0 disables. Only used with DISK_STORE_LOG or DISK_STORE_TLV;
+// the raw image rewrites its pages in place and has no spare flash to erase ahead.
+#ifndef DISK_ERASE_AHEAD_MS
+#define DISK_ERASE_AHEAD_MS 0
+#endif
+
+// Read every page, record or table back after programming it. A mismatch is retried up to
+// DISK_VERIFY_RETRIES times; a raw image page that keeps failing is then moved to another
+// page of the user data region (see README, Verify and Bad Page Retirement).
+#ifndef DISK_VERIFY
+#define DISK_VERIFY 1
+#endif
+
+#ifndef DISK_VERIFY_RETRIES
+#define DISK_VERIFY_RETRIES 2
+#endif
+
+// F103 raw image: erase cycles a free page may be ahead of the least-erased page holding
+// image data before that page's data is moved onto it (static wear leveling). Only used
+// when the user data region has room for the page map (see README, Wear Leveling).
+#ifndef DISK_WEAR_SPREAD
+#define DISK_WEAR_SPREAD 16
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+// Pluggable sector copy engine. read_sector and write_sector move every sector through
+// the selected engine: the CPU engine (default, also the host build) or, on STM32F411
+// built with DISK_COPY_DMA=1, DMA2 Stream0 memory-to-memory transfers. Transfers are
+// queued with start() and completed by wait(), so Disk_SecReadMulti() chains all the
+// sectors of a USB read into one DMA run while the CPU works out the next sector.
+
+#include "disk.h"
+
+#ifndef DISK_COPY_DMA
+#define DISK_COPY_DMA 0
+#endif
+
+// Shorter or unaligned transfers are not worth the DMA setup and are done by the CPU
+#ifndef DISK_COPY_DMA_MIN_BYTES
+#define DISK_COPY_DMA_MIN_BYTES 64
+#endif
+
+// Transfers queued behind the running one; start() waits for a slot when the queue is full
+#ifndef DISK_COPY_DMA_QUEUE
+#define DISK_COPY_DMA_QUEUE 8
+#endif
+
+struct disk_copy_engine {
+	const char *name;
+	void(*start)(void *dst, const void *src, u32 len); // Queue a copy, src == NULL zero-fills
+	void(*wait)(void);                                 // Block until every queued transfer is done
+};
+
+struct disk_copy {
+	const struct disk_copy_engine *cpu;
+	const struct disk_copy_engine *dma; // NULL unless built for F411 with DISK_COPY_DMA=1
+	void(*dma_irq_handler)(void);       // Call from DMA2_Stream0_IRQHandler
+	u32(*measure)(const struct disk_copy_engine *engine, bool zero_fill); // disk_prof_now() ticks per 512-byte sector
+};
+
+extern const struct disk_copy DiskCopy;
+extern const struct disk_copy_engine DiskCopyCpu; // default engine, same as DiskCopy.cpu
@@ -0,0 +1,90 @@
+#pragma once
+
+// Flash geometry. Each supported device has one const descriptor in src/disk_flash.c:
+// its erase units, program widths, the supply voltage rules that limit them and typical
+// datasheet timings. The library erases and programs only through DiskFlash, and the host
+// simulator (host/hal_sim.c) instantiates the same descriptor, so adding a device means
+// adding a descriptor and its HAL erase call.
+//
+// Supported: STM32F103xB, STM32F401xE, STM32F411xE, STM32F446xx, STM32L432xx, STM32G071xx.
+
+#include "disk.h"
+
+// Supply voltage in mV. On F4 it limits the program width (and the erase parallelism),
+// see the voltage rules of the descriptor.
+#ifndef DISK_FLASH_VOLTAGE_MV
+#define DISK_FLASH_VOLTAGE_MV 3300
+#endif
+
+#define DISK_FLASH_RUNS 4   // runs of equal erase units per device
+#define DISK_FLASH_RULES 3  // voltage rules per device
+#define DISK_FLASH_WIDTHS 4 // program widths: 1, 2, 4 and 8 bytes
+#define DISK_FLASH_NONE 0xFFFFFFFFUL
+
+#if defined(STM32F103xB)
+#define DISK_FLASH_WRITE_MIN 2 // smallest program operation the flash formats append
+#elif defined(STM32F401xE) || defined(STM32F411xE) || defined(STM32F446xx)
+#define DISK_FLASH_SECTORS 1   // erase units of different sizes, addressed by number
+#define DISK_FLASH_WRITE_MIN 2
+#elif defined(STM32L432xx) || defined(STM32G071xx)
+#define DISK_FLASH_WRITE_MIN 8 // ECC: double-words only, each programmed once
+#else
+#error "Unsupported device: add its flash descriptor to src/disk_flash.c"
+#endif
+
+#ifndef DISK_FLASH_SECTORS
+#define DISK_FLASH_SECTORS 0
+#endif
+
+// Erase unit the raw image is laid out in: a page, or on F4 a 16KB slot of the sector
+#ifndef FLASH_PAGE_SIZE
+#if defined(STM32F103xB)
+#define FLASH_PAGE_SIZE ((uint32_t)0x400)
+#elif DISK_FLASH_SECTORS
+#define FLASH_PAGE_SIZE ((uint32_t)0x4000)
+#else
+#define FLASH_PAGE_SIZE ((uint32_t)0x800)
+#endif
+#endif
+
+// n rounded up to a whole number of DISK_FLASH_WRITE_MIN units
+#define DISK_FLASH_ALIGN(n) (((n) + DISK_FLASH_WRITE_MIN - 1UL) & ~(DISK_FLASH_WRITE_MIN - 1UL))
+
+enum {
+	DISK_FLASH_OVERWRITE_ZERO, // a programmed unit only takes all zeros again (F1 PGERR, L4/G0 PROGERR)
+	DISK_FLASH_OVERWRITE_AND,  // new data is ANDed into programmed bits (F4)
+};
+
+typedef struct {
+	u32 size;        // bytes per erase unit
+	u16 count;       // consecutive units of this size, 0 ends the table
+	u16 erase_ms[DISK_FLASH_WIDTHS]; // typical erase time by program width (parallelism), 0 = width unused
+} disk_flash_run_t;
+
+typedef struct {
+	u16 min_mv;    // from this supply voltage up
+	u8 max_width;  // widest program operation, bytes
+	u8 range;      // HAL FLASH_VOLTAGE_RANGE_x (F4)
+} disk_flash_rule_t;
+
+typedef struct {
+	const char *name;
+	uintptr_t base;
+	disk_flash_run_t runs[DISK_FLASH_RUNS];     // erase units from base
+	u32 program_ns[DISK_FLASH_WIDTHS];          // typical time per program operation by width, 0 = unsupported
+	disk_flash_rule_t rules[DISK_FLASH_RULES];  // ascending min_mv, max_width 0 ends; none = no limit
+	u8 overwrite;                               // DISK_FLASH_OVERWRITE_*
+	u32 endurance;                              // guaranteed erase cycles per unit
+} disk_flash_geometry_t;
+
+struct disk_flash {
+	const disk_flash_geometry_t*(*geometry)(void);
+	// Erase unit holding addr, DISK_FLASH_NONE outside flash; *base and *size may be NULL
+	u32(*unit)(uintptr_t addr, uintptr_t *base, u32 *size);
+	u32(*width)(void);                           // widest program operation at DISK_FLASH_VOLTAGE_MV
+	HAL_StatusTypeDef(*erase)(uintptr_t addr);   // erase the unit holding addr
+	// Program one operation of width bytes (1, 2, 4 or 8, supported and at most width())
+	HAL_StatusTypeDef(*program)(uintptr_t addr, const u8 *src, u32 width);
+};
+
+extern const struct disk_flash DiskFlash;
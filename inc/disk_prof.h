@@ -0,0 +1,105 @@
+#pragma once
+
+// Hot-path instrumentation. Build with DISK_PROF=1 to time the library's stages with the
+// DWT cycle counter (Cortex-M3/M4), SysTick (Cortex-M0+, which has no DWT counter) or
+// clock_gettime (host build). Each probe keeps
+// count/min/max/total and a log2 histogram in a fixed table; with DISK_PROF=0 (default)
+// the probes compile to nothing.
+
+#include "disk.h"
+
+#ifndef DISK_PROF
+#define DISK_PROF 0
+#endif
+
+// X(id, label)
+#define DISK_PROF_PROBES(X)                     \
+	X(READ_SECTOR, "read_sector")               \
+	X(WRITE_SECTOR, "write_sector")             \
+	X(VALIDATE_FILE, "validate_file")           \
+	X(FLASH_ERASE, "erase_flash_page")          \
+	X(FLASH_PROGRAM, "program loop")            \
+	X(FLASH_VERIFY, "verify")                   \
+	X(FLUSH, "flush")
+
+#define DISK_PROF_ENUM(id, label) DISK_PROF_##id,
+enum {
+	DISK_PROF_PROBES(DISK_PROF_ENUM)
+	DISK_PROF_PROBE_CNT
+};
+#undef DISK_PROF_ENUM
+
+#define DISK_PROF_HIST_BINS 32 // bin n counts durations in [2^(n-1), 2^n) ticks, bin 0 counts 0
+
+typedef struct {
+	u32 count;
+	u32 min;
+	u32 max;
+	uint64_t total;
+	u32 hist[DISK_PROF_HIST_BINS];
+} disk_prof_probe_t;
+
+struct disk_prof {
+	void(*init)(void);  // Start the cycle counter and clear the table
+	void(*reset)(void); // Clear the table
+	void(*record)(u32 probe, u32 ticks);
+	const disk_prof_probe_t*(*get)(u32 probe);
+	const char*(*name)(u32 probe);
+	u32(*ticks_per_us)(void); // Core clock in MHz on target, 1000 on host (ticks are ns)
+	void(*dump)(void);        // Log every probe with app_log_info
+};
+
+extern const struct disk_prof DiskProf;
+
+// Tick source shared with disk_trace.h: core cycles on target, nanoseconds on host
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+static inline void disk_prof_start_counter(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+static inline u32 disk_prof_now(void)
+{
+	return DWT->CYCCNT;
+}
+#elif defined(__ARM_ARCH)
+// Cortex-M0+: the HAL's 1 ms SysTick, clocked by the core, extended with its count down.
+// A span that has the tick interrupt masked across a reload comes out 1 ms short.
+static inline void disk_prof_start_counter(void)
+{
+}
+static inline u32 disk_prof_now(void)
+{
+	u32 ms, val;
+	do
+	{
+		ms = HAL_GetTick();
+		val = SysTick->VAL;
+	} while (ms != HAL_GetTick());
+	return ms * (SysTick->LOAD + 1) + (SysTick->LOAD - val);
+}
+#else
+#include <time.h>
+static inline void disk_prof_start_counter(void)
+{
+}
+static inline u32 disk_prof_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u32)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#endif
+
+#if DISK_PROF
+
+#define DISK_PROF_BEGIN(id) const u32 disk_prof_t0_##id = disk_prof_now()
+#define DISK_PROF_END(id) DiskProf.record(DISK_PROF_##id, disk_prof_now() - disk_prof_t0_##id)
+
+#else
+
+#define DISK_PROF_BEGIN(id) ((void)0)
+#define DISK_PROF_END(id) ((void)0)
+
+#endif
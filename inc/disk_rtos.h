@@ -0,0 +1,24 @@
+#pragma once
+
+// Optional FreeRTOS integration (also works under CubeMX's CMSIS-RTOS wrappers).
+// Compile src/disk_rtos.c with DISK_USE_FREERTOS defined and call DiskRtos.start()
+// after Disk.init() instead of polling Disk.process() from the main loop.
+
+#include <stdbool.h>
+#include "disk.h"
+
+// Priority of the commit task; validation and flash programming run at this level
+#ifndef DISK_RTOS_TASK_PRIORITY
+#define DISK_RTOS_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+
+// Stack depth in words; entry callbacks and snprintf run on this stack
+#ifndef DISK_RTOS_STACK_WORDS
+#define DISK_RTOS_STACK_WORDS 512
+#endif
+
+struct disk_rtos {
+	bool(*start)(void); // Create the commit task and debounce timer, hook host writes
+};
+
+extern const struct disk_rtos DiskRtos;
@@ -0,0 +1,75 @@
+#pragma once
+
+// Optional STATS.TXT: a read-only file in the root directory, rendered by read_sector from
+// live counters so field technicians can read performance and wear numbers with any file
+// browser. Build with DISK_STATS=1 and add src/disk_stats.c. The file never reaches flash:
+// its directory entry and FAT chain are injected into sector reads and stripped from
+// host writes, and its clusters sit at the end of the disk, outside disk_buffer.
+
+#include "disk.h"
+
+#ifndef DISK_STATS
+#define DISK_STATS 0
+#endif
+
+// Clusters (one sector each) reserved at the end of the disk for the rendered text
+#ifndef DISK_STATS_SECTORS
+#define DISK_STATS_SECTORS 4
+#endif
+
+#define DISK_STATS_FILENAME "STATS   TXT"
+#define DISK_STATS_PAGES (0x4000 / FLASH_PAGE_SIZE) // flash pages behind disk_buffer
+#define DISK_STATS_HIST_BINS 16                     // commit latency, bin n counts [2^(n-1), 2^n) ms
+
+enum {
+	DISK_REGION_BOOT, // boot and reserved sectors
+	DISK_REGION_FAT,
+	DISK_REGION_DIR,
+	DISK_REGION_DATA,
+	DISK_REGION_CNT
+};
+
+typedef struct {
+	u32 reads[DISK_REGION_CNT];  // sectors
+	u32 writes[DISK_REGION_CNT]; // sectors
+	u32 commits;
+	u32 commit_ms_max;
+	u32 commit_ms_hist[DISK_STATS_HIST_BINS];
+	u32 erases[DISK_STATS_PAGES];
+	u32 bytes_programmed;
+	u32 program_errors;
+	u32 rejected_writes;     // data sectors refused by the dot-file protection
+	u32 validation_failures; // commits storing a value that was rejected or missing (host save, rollback or boot)
+	u32 verify_failures;     // DISK_VERIFY: programmed data that did not read back
+	u32 retired_pages;       // raw image pages moved to a spare page
+	u32 erasing_commits;     // DISK_ERASE_AHEAD_MS: commits that still had to erase
+	u32 erase_ahead_runs;    // idle compactions done ahead of a commit
+	u32 erase_ahead_hits;    // commits that only programmed flash erased ahead for them
+	u32 erase_ahead_saved_ms; // erase time those commits did not wait for
+	u32 debounce_ms;         // current commit delay after the last host write
+	u32 early_commits;       // commits the delay fired while the host was still saving
+	u32 validated_ahead;     // DISK_VALIDATE_AHEAD: commits whose file was validated while it landed
+	u32 streamed_commits;    // DISK_STREAM_COMMIT: commits that found file sectors programmed ahead
+	u32 streamed_sectors;    // sectors those commits did not have to program
+	u32 stream_voided;       // sectors programmed ahead that the host rewrote or the commit did not use
+	u32 stepped_updates;     // DISK_UPDATE_STEPS: update callbacks run from Disk.process()
+	u32 update_steps;        // process() calls that ran them
+} disk_stats_t;
+
+struct disk_stats {
+	u32(*render)(char *out, u32 cap); // Write the STATS.TXT text, returns its length
+	const disk_stats_t*(*get)(void);
+	void(*reset)(void);
+	void(*commit_done)(u32 ms); // Count a commit and its latency
+};
+
+extern const struct disk_stats DiskStats;
+
+#if DISK_STATS
+extern disk_stats_t disk_stats_counters;
+#define DISK_STATS_ADD(field, n) (disk_stats_counters.field += (n))
+#define DISK_STATS_SET(field, v) (disk_stats_counters.field = (v))
+#else
+#define DISK_STATS_ADD(field, n) ((void)0)
+#define DISK_STATS_SET(field, v) ((void)0)
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+// Compressed image log. With DISK_STORE_LOG=1 the user data region holds a sequence of
+// compressed disk_buffer images instead of one raw 16KB copy. Each commit appends a record
+// behind the previous one; the region is only erased when the next record does not fit.
+// load_from_flash() decompresses the newest record whose CRC matches.
+//
+// Record layout (4-byte aligned, programmed header-last so a torn write never has a magic):
+//   disk_store_record_t | metadata stream (FAT1, FAT2, root dir) | file stream (FILE_SECTOR)
+// The metadata stream is empty when DISK_META_SYNTH=1. A streamed record (DISK_STREAM_COMMIT)
+// has the file stream first, its first sectors programmed while the host was still writing:
+//   disk_store_record_t | file stream | metadata stream
+// A void record (raw_len 0) only covers sectors programmed ahead for a commit that did not
+// use them. The scan steps over it.
+//
+// Both streams use the same byte codec. It suits the two halves of the image: zero runs
+// cover the mostly-empty metadata, LZ matches cover repeated text.
+//   0LLLLLLL                   L+1 literal bytes follow
+//   10HHHHHH LLLLLLLL          (H<<8 | L)+1 zero bytes
+//   11LLLLLL OOOOOOOO OOOOOOOO copy L+4 bytes from (O+1) bytes back (O little-endian)
+
+#include "disk.h"
+
+#ifndef DISK_STORE_LOG
+#define DISK_STORE_LOG 0
+#endif
+
+#define DISK_STORE_MAGIC 0x474F4C44UL // "DLOG"
+
+typedef struct {
+	u32 magic;     // DISK_STORE_MAGIC
+	u32 seq;       // Commit number, newer records have higher numbers
+	u16 raw_len;   // Uncompressed image size
+	u16 meta_len;  // Compressed size of the metadata stream
+	u16 file_len;  // Compressed size of the file stream
+	u16 chunks;    // Streamed record: leading 512-byte file sectors compressed one part each,
+	               // DISK_STORE_UNCHUNKED otherwise
+	u32 crc;       // CRC-32 of the uncompressed image
+} disk_store_record_t;
+
+#define DISK_STORE_UNCHUNKED 0xFFFF
+
+#define DISK_STORE_ALIGN(n) (((n) + 3UL) & ~3UL)
+
+struct disk_store {
+	// Compress len bytes of src, handing the output to emit() in order. emit == NULL only
+	// counts. Returns the compressed size.
+	u32(*compress)(const u8 *src, u32 len, void(*emit)(const u8 *p, u32 n));
+	// Compress src[start..end) as the next part of the stream the previous call compressed
+	// src[0..start) into: matches may reach back into it. start == 0 starts a new stream.
+	u32(*compress_more)(const u8 *src, u32 start, u32 end, void(*emit)(const u8 *p, u32 n));
+	// Returns dst_len if src decoded to exactly dst_len bytes, 0 for a corrupt stream
+	u32(*decompress)(const u8 *src, u32 src_len, u8 *dst, u32 dst_len);
+	u32(*crc32)(u32 crc, const u8 *p, u32 len); // Start with crc = 0
+};
+
+extern const struct disk_store DiskStore;
@@ -0,0 +1,49 @@
+#pragma once
+
+// Binary config store. With DISK_STORE_TLV=1 the user data region holds no disk image at
+// all: each commit appends one record per entry whose value changed, then a commit record.
+// Disk.init() rebuilds CONFIG.TXT, its directory entry and the FAT chain in RAM from the
+// newest committed value of every entry, so boot never parses text. The region is erased
+// and rewritten with the current values only when it is full.
+//
+// Record: disk_tlv_record_t, then len value bytes, padded to 4 bytes. The key half-word is
+// programmed last, so a record cut short by a reset reads as erased flash and ends the log.
+// Records after the last commit record belong to an interrupted commit and are ignored.
+// Needs src/disk_store.c (CRC-32).
+
+#include "disk.h"
+
+#ifndef DISK_STORE_TLV
+#define DISK_STORE_TLV 0
+#endif
+
+// Commits kept when the region is compacted, the new one included: the oldest kept as a
+// full snapshot, the rest as the change records they were written as. History is staged
+// in RAM (the 8KB file_buffer) and limited to half the region. 1 keeps only the newest.
+#ifndef DISK_TLV_HISTORY
+#define DISK_TLV_HISTORY 8
+#endif
+
+// Restore a stored commit when the host writes ROLLBACK.TXT holding its number, or "-n"
+// for n commits back. See Disk.restore().
+#ifndef DISK_TLV_ROLLBACK
+#define DISK_TLV_ROLLBACK 0
+#endif
+
+#define DISK_TLV_KEY_COMMIT 0x0000 // value: u32 commit number
+#define DISK_TLV_KEY_ERASED 0xFFFF
+
+enum {
+	DISK_TLV_TEXT = 1,   // value as printed to CONFIG.TXT, without "ENTRY=" and comment
+	DISK_TLV_COMMIT = 2,
+};
+
+typedef struct {
+	u16 key;      // Low half of the CRC-32 of the entry name, never 0x0000 or 0xFFFF
+	u16 len;      // Value bytes
+	u8 type;      // DISK_TLV_*
+	u8 reserved;  // 0xFF
+	u16 crc;      // Low half of the CRC-32 of key and value
+} disk_tlv_record_t;
+
+#define DISK_TLV_ALIGN(n) (((n) + 3UL) & ~3UL)
@@ -0,0 +1,83 @@
+#pragma once
+
+// Binary event trace. Build with DISK_TRACE=1 (and add src/disk_trace.c) to record the
+// library's trace points into a RAM ring buffer: a timestamp, an event ID and two u32
+// arguments, about 20 cycles per event. The format strings never reach the firmware:
+// host/tracedump.c builds them from the same table and expands an exported buffer to
+// text or Chrome trace JSON. With DISK_TRACE=0 (default) the trace points compile to nothing.
+
+#include "disk_prof.h"
+
+#ifndef DISK_TRACE
+#define DISK_TRACE 0
+#endif
+
+// Records in the ring, power of two (16 bytes each)
+#ifndef DISK_TRACE_DEPTH
+#define DISK_TRACE_DEPTH 256
+#endif
+
+// X(id, phase, name, format): phase 'B'/'E' open/close a span named name, 'i' is instant.
+// format takes up to two %u/%x conversions, filled from the event's two arguments.
+#define DISK_TRACE_EVENTS(X)                                                              \
+	X(READ_BOOT, 'i', "read", "read boot/reserved sector %u")                             \
+	X(READ_FAT, 'i', "read", "read FAT%u sector %u")                                      \
+	X(READ_DIR, 'i', "read", "read dir sector %u")                                        \
+	X(READ_DIR_CONFIG, 'i', "read", "dir: CONFIG.TXT cluster=%u size=%u")                 \
+	X(READ_FILE, 'i', "read", "read file sector %u")                                      \
+	X(WRITE_DIR_CONFIG, 'i', "write", "dir write: CONFIG.TXT cluster=%u size=%u")         \
+	X(WRITE_ALLOW, 'i', "write", "allow CONFIG.TXT write to cluster %u (sector %u)")      \
+	X(WRITE_REJECT_CLUSTER2, 'i', "write", "reject non-config write to sector %u (first byte 0x%02x)") \
+	X(WRITE_REJECT_DOT, 'i', "write", "reject dot file write to cluster %u (sector %u)")  \
+	X(VALIDATE_BEGIN, 'B', "validate_file", "validate root_addr=%u")                      \
+	X(VALIDATE_SOURCE, 'i', "validate_file", "read source %u (0 p_file, 1 FILE_SECTOR, 2 flash, 3 defaults)") \
+	X(VALIDATE_LINE, 'i', "validate_file", "line %u: %u bytes")                           \
+	X(VALIDATE_PARSED, 'i', "validate_file", "parsed %u lines")                           \
+	X(VALIDATE_END, 'E', "validate_file", "rebuilt file size=%u, illegal=%u")             \
+	X(FLUSH_BEGIN, 'B', "flush", "flush")                                                 \
+	X(FLUSH_END, 'E', "flush", "flush done")                                              \
+	X(ERASE_BEGIN, 'B', "erase", "erase 0x%08x")                                          \
+	X(ERASE_END, 'E', "erase", "erase status %u")                                         \
+	X(PROGRAM_BEGIN, 'B', "program", "program %u bytes at 0x%08x")                        \
+	X(PROGRAM_END, 'E', "program", "program done")                                        \
+	X(STORE_APPEND, 'i', "store", "append %u-byte record at offset 0x%x")                 \
+	X(VERIFY_FAIL, 'i', "verify", "verify failed at 0x%08x (%u bytes)")                   \
+	X(PAGE_RETIRED, 'i', "verify", "flash page 0x%08x retired")                           \
+	X(CALLBACK_OVERRUN, 'i', "callback", "entry %u callback over budget: %u us")
+
+#define DISK_TRACE_ENUM(id, phase, name, format) DISK_TRACE_##id,
+enum {
+	DISK_TRACE_EVENTS(DISK_TRACE_ENUM)
+	DISK_TRACE_EVENT_CNT
+};
+#undef DISK_TRACE_ENUM
+
+typedef struct {
+	u32 timestamp; // disk_prof_now() ticks
+	u32 event;
+	u32 arg[2];
+} disk_trace_rec_t;
+
+// Export format: this header, then count records oldest first
+#define DISK_TRACE_MAGIC 0x43525444UL // "DTRC"
+typedef struct {
+	u32 magic;
+	u32 ticks_per_us;
+	u32 count;
+	u32 dropped; // older records overwritten before the export
+} disk_trace_header_t;
+
+struct disk_trace {
+	void(*init)(void);  // Start the tick counter and clear the ring
+	void(*reset)(void); // Clear the ring
+	void(*record)(u32 event, u32 arg0, u32 arg1);
+	u32(*export)(u8 *out, u32 cap); // Header + records, returns bytes written (0 if cap is too small for the header)
+};
+
+extern const struct disk_trace DiskTrace;
+
+#if DISK_TRACE
+#define DISK_TRACE_EVENT(id, arg0, arg1) DiskTrace.record(DISK_TRACE_##id, (u32)(arg0), (u32)(arg1))
+#else
+#define DISK_TRACE_EVENT(id, arg0, arg1) ((void)0)
+#endif
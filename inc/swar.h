@@ -0,0 +1,136 @@
+#pragma once
+
+// 32-bit SWAR (SIMD within a register) kernels for the sector and text loops.
+// Each step looks at four bytes with a handful of ALU instructions instead of four
+// compare-and-branch iterations. Loads go through memcpy, which compiles to a single
+// LDR on Cortex-M3/M4 and x86 whatever the alignment (Cortex-M0 falls back to bytes).
+// Little-endian only: the first matching byte is the lowest set bit of a match mask.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "types.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "swar.h assumes a little-endian target"
+#endif
+
+#define SWAR_ONES 0x01010101UL
+#define SWAR_HIGHS 0x80808080UL
+
+static inline u32 swar_load(const void *p)
+{
+	u32 w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static inline void swar_store(void *p, u32 w)
+{
+	memcpy(p, &w, sizeof(w));
+}
+
+// High bit set in every zero byte of w. A borrow can also flag bytes above the first
+// zero byte, so only the lowest flag is exact - enough for "find first".
+static inline u32 swar_zero_bytes(u32 w)
+{
+	return (w - SWAR_ONES) & ~w & SWAR_HIGHS;
+}
+
+// Flags the bytes of w equal to c (same caveat as swar_zero_bytes)
+static inline u32 swar_match_bytes(u32 w, u8 c)
+{
+	return swar_zero_bytes(w ^ (SWAR_ONES * c));
+}
+
+// Byte index (0-3) of the lowest flagged byte, mask must not be 0
+static inline u32 swar_first_byte(u32 mask)
+{
+	return (u32)__builtin_ctz(mask) >> 3;
+}
+
+// Index of the first byte equal to c, or len if there is none
+static inline u32 swar_find_byte(const u8 *p, u32 len, u8 c)
+{
+	u32 i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		u32 m = swar_match_bytes(swar_load(p + i), c);
+		if (m)
+		{
+			return i + swar_first_byte(m);
+		}
+	}
+	for (; i < len && p[i] != c; i++)
+	{
+	}
+	return i;
+}
+
+// Index of the first byte equal to a or b, or len if there is none
+static inline u32 swar_find_either(const u8 *p, u32 len, u8 a, u8 b)
+{
+	u32 i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		u32 w = swar_load(p + i);
+		u32 m = swar_match_bytes(w, a) | swar_match_bytes(w, b);
+		if (m)
+		{
+			return i + swar_first_byte(m);
+		}
+	}
+	for (; i < len && p[i] != a && p[i] != b; i++)
+	{
+	}
+	return i;
+}
+
+// True if every byte of p is c (0 for an all-zero sector, 0xFF for erased flash)
+static inline bool swar_is_fill(const u8 *p, u32 len, u8 c)
+{
+	u32 pattern = SWAR_ONES * c;
+	u32 diff = 0;
+	u32 i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		diff |= swar_load(p + i) ^ pattern;
+	}
+	for (; i < len; i++)
+	{
+		diff |= p[i] ^ c;
+	}
+	return diff == 0;
+}
+
+// Index of the first byte where a and b differ, or len if they are equal
+static inline u32 swar_first_diff(const u8 *a, const u8 *b, u32 len)
+{
+	u32 i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		u32 x = swar_load(a + i) ^ swar_load(b + i);
+		if (x)
+		{
+			return i + swar_first_byte(x);
+		}
+	}
+	for (; i < len && a[i] == b[i]; i++)
+	{
+	}
+	return i;
+}
+
+// Word-at-a-time copy for buffers that must not overlap
+static inline void swar_copy(u8 *dst, const u8 *src, u32 len)
+{
+	u32 i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		swar_store(dst + i, swar_load(src + i));
+	}
+	for (; i < len; i++)
+	{
+		dst[i] = src[i];
+	}
+}
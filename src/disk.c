@@ -1,5 +1,13 @@
 #include "disk.h"
+#include "disk_prof.h"
+#include "disk_stats.h"
+#include "disk_trace.h"
+#include "disk_copy.h"
+#include "disk_store.h"
+#include "disk_tlv.h"
+#include "swar.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 // Linker symbols for user data flash region (defined in linker script)
 // Declared as char arrays to avoid "reading N bytes from 4-byte object" warnings
@@ -7,8 +15,9 @@ extern char _user_data_start[];
 extern char _user_data_size[];
 
 // Use linker symbols instead of hardcoded addresses
-#define APP_BASE ((uint32_t)_user_data_start)
-#define APP_SIZE ((uint32_t)_user_data_size)
+// (uintptr_t so the host build, where pointers are 64-bit, sees no truncating casts)
+#define APP_BASE ((uintptr_t)_user_data_start)
+#define APP_SIZE ((uintptr_t)_user_data_size)
 
 // constants
 #define SECTOR_SIZE 512
@@ -19,12 +28,24 @@ extern char _user_data_size[];
 // Data area starts at sector 64 (cluster 2)
 #define DATA_FIRST_SECTOR 64
 #define SECTOR_TO_CLUSTER(s) ((s) - DATA_FIRST_SECTOR + 2)
+// Erase-ahead needs a log format: the raw image has no spare flash
+#define ERASE_AHEAD (DISK_ERASE_AHEAD_MS > 0 && (DISK_STORE_LOG || DISK_STORE_TLV))
+// Streaming programs into the log's erased end, following the validate-ahead stream
+#define STREAM_COMMIT (DISK_STREAM_COMMIT && DISK_STORE_LOG && DISK_VALIDATE_AHEAD)
 static uc32 VOLUME = 0x40DD8D18;
 static const u8 fat_data[] = {0xF8, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 static u8 CONFIG_FILENAME[] = "CONFIG  TXT";
 
 // globals - increased buffer for larger config files
-static u8 disk_buffer[0x4000]; // 16KB buffer for larger configs
+#if DISK_META_SYNTH
+// File data only: the FAT and root directory are synthesized from files[] on read
+#define META_BYTES 0
+#define DISK_BUFFER_SIZE 0x3C00 // 15KB, whole F103 pages
+#else
+#define META_BYTES 0x600 // FAT1, FAT2 and the root directory sector
+#define DISK_BUFFER_SIZE 0x4000
+#endif
+static u8 disk_buffer[DISK_BUFFER_SIZE]; // RAM image of the volume
 static u32 disk_buffer_temp[(SECTOR_SIZE + 32 + 28) / 4];
 static u8 *pdisk_buffer_temp = (u8 *)&disk_buffer_temp[0];
 static u8 file_buffer[SECTOR_SIZE * 16]; // 8KB for reading file content
@@ -38,21 +59,90 @@ static u8 file_content_buffer[FILE_CHAR_CNT];
 // Deferred flash write state
 static uint32_t last_write_tick = 0;
 static bool pending_flash_write = false;
-#define FLASH_WRITE_DELAY_MS 500
+static volatile u32 write_generation; // host saves deferred so far: one landing during a commit re-arms it
+static bool values_rejected; // a value was rejected or missing since the last commit, which counts it once
+static void (*write_hook)(void) = NULL;
+static const struct disk_copy_engine *copy_engine = &DiskCopyCpu;
+static u32 flash_erases;        // successful erase_flash_page() calls
+static bool region_misaligned;  // load_from_flash(): erasing the region would take code along, never program it
+#if ERASE_AHEAD
+static bool erase_ahead_armed;  // a commit finished: prepare flash for the next one when idle
+static u32 erase_ahead_ms;      // erase time spent ahead, credited to the next commit
+#endif
+
+// Host write bursts, one per save, for the commit delay (DISK_DEBOUNCE_ADAPTIVE)
+static struct
+{
+	u32 delay_ms;  // idle time after the last host write before process() commits
+	u32 last_tick; // last host write
+	u32 gap_max;   // largest gap between host writes of the save being committed
+	u32 gaps;      // gaps measured for it
+	u32 writes;    // host writes since the last commit
+	bool timed;    // the last commit was fired by the delay after host writes
+#if DISK_DEBOUNCE_ADAPTIVE
+	bool learned;  // gap8/dev4 hold at least one sample
+	u32 gap8;      // smoothed largest gap of a save, ms x 8
+	u32 dev4;      // its smoothed mean deviation, ms x 4
+#endif
+} debounce = {.delay_ms = FLASH_WRITE_DELAY_MS};
+
+// Erase budget (DISK_ERASE_BUDGET_PER_HOUR, DISK_LIFETIME_YEARS): a token bucket of erases
+#define BUDGET (DISK_ERASE_BUDGET_PER_HOUR > 0 || DISK_LIFETIME_YEARS > 0)
+#define BUDGET_ERASE (3600000LL * 1000) // one erase in credit units: ms per hour x milli
+static struct
+{
+	u32 units;          // erase units in the user data region
+	u32 rate;           // erases per 1000 hours, credit gained per ms
+	u32 cap;            // erases the bucket holds: the burst, or a whole region erase if more
+	int64_t credit;     // erases available x BUDGET_ERASE, negative = overspent
+	u32 tick;           // last refill
+	u32 erases;         // flash_erases already charged
+	u32 start_tick;     // session start, for the projection
+	u32 session_erases; // flash_erases at session start
+	bool holding;       // a due commit is waiting for credit since hold_tick
+	u32 hold_tick;
+	u32 held;
+	u32 held_ms;
+	bool eject;         // Disk.eject(): commit now
+} budget;
 
 static FILE_ENTRY entries[FILE_ENTRY_CNT];
 
+static inline bool buffers_differ(const u8 *a, const u8 *b, u32 len)
+{
+	return swar_first_diff(a, b, len) != len;
+}
+
 // pointers - layout in disk_buffer (16KB total)
 //  0x000-0x1FF: FAT1 (512 bytes)
 //  0x200-0x3FF: FAT2 (512 bytes)
 //  0x400-0x5FF: ROOT_SECTOR (512 bytes)
 //  0x600-0x3FFF: FILE_SECTOR (~14KB for file data)
+// With DISK_META_SYNTH, FILE_SECTOR starts at 0x000
+#if !DISK_META_SYNTH
 static u8 *FAT1_SECTOR = &disk_buffer[0x000];
 static u8 *FAT2_SECTOR = &disk_buffer[0x200];
 static u8 *ROOT_SECTOR = &disk_buffer[0x400];
 static u8 *VOLUME_BASE = &disk_buffer[0x416];
-static u8 *FILE_SECTOR = &disk_buffer[0x600];
-#define FILE_SECTOR_SIZE (0x4000 - 0x600) // Available space for file data
+#endif
+static u8 *FILE_SECTOR = &disk_buffer[META_BYTES];
+#define FILE_SECTOR_SIZE (DISK_BUFFER_SIZE - META_BYTES) // Available space for file data
+#define DIR_SLOT_CNT (SECTOR_SIZE / 32)                   // entries in the first root directory sector
+
+#if DISK_META_SYNTH
+// What the library keeps of a directory entry. Slot n is entry n of the first root
+// directory sector; a slot is free when name[0] is 0x00.
+typedef struct {
+	u32 size;     // bytes
+	u16 cluster;  // first cluster, 0 if the file has no data
+	u16 time;     // last write time and date, FAT format
+	u16 date;
+	u8 attr;
+	u8 name[11];  // 8.3, as written by the host
+} disk_file_t;
+
+static disk_file_t files[DIR_SLOT_CNT];
+#endif
 
 uc8 BOOT_SEC[SECTOR_SIZE] = {
 	0xEB, 0x3C, 0x90,									   // code to jump to the bootstrap code
@@ -62,7 +152,7 @@ uc8 BOOT_SEC[SECTOR_SIZE] = {
 	0x08, 0x00,											   // # of reserved sectors
 	0x02,												   // FAT copies
 	0x00, 0x02,											   // root entries
-	0x50, 0x00,											   // total number of sectors
+	0x00, 0x10,											   // total number of sectors (SECTOR_CNT)
 	0xF8,												   // media descriptor (0xF8 = Fixed disk)
 	0x0c, 0x00,											   // sectors per FAT
 	0x01, 0x00,											   // sectors per track
@@ -74,7 +164,8 @@ uc8 BOOT_SEC[SECTOR_SIZE] = {
 	0x29,												   // extended boot signature
 	0xA2, 0x98, 0xE4, 0x6C,								   // volume serial number
 	'R', 'A', 'M', 'D', 'I', 'S', 'K', ' ', ' ', ' ', ' ', // volume label
-	'F', 'A', 'T', '1', '2', ' ', ' ', ' '				   // filesystem type
+	'F', 'A', 'T', '1', '2', ' ', ' ', ' ',				   // filesystem type
+	[510] = 0x55, 0xAA									   // boot sector signature
 };
 
 // util functions
@@ -90,270 +181,2308 @@ static void Upper(u8 *str, u16 len)
 	}
 }
 
-// flash interface functions
-#if defined(STM32F411xE)
-static uint32_t GetSectorNumber(uint32_t Address)
-{
-	if (Address < ADDR_FLASH_SECTOR_1)
-		return FLASH_SECTOR_0;
-	else if (Address < ADDR_FLASH_SECTOR_2)
-		return FLASH_SECTOR_1;
-	else if (Address < ADDR_FLASH_SECTOR_3)
-		return FLASH_SECTOR_2;
-	else if (Address < ADDR_FLASH_SECTOR_4)
-		return FLASH_SECTOR_3;
-	else if (Address < ADDR_FLASH_SECTOR_5)
-		return FLASH_SECTOR_4;
-	else if (Address < ADDR_FLASH_SECTOR_6)
-		return FLASH_SECTOR_5;
-	else if (Address < ADDR_FLASH_SECTOR_7)
-		return FLASH_SECTOR_6;
-	else
-		return FLASH_SECTOR_7;
+// Arm the deferred flash write and let the application know there is work pending
+static void defer_flash_write(void)
+{
+	write_generation++;
+	pending_flash_write = true;
+	last_write_tick = HAL_GetTick();
+	if (write_hook)
+	{
+		write_hook();
+	}
 }
+
+// Feed the largest gap of a save into the delay: Jacobson/Karels smoothing as used for TCP
+// retransmission timeouts, delay = gap + 2 x deviation
+static void debounce_sample(u32 gap)
+{
+#if DISK_DEBOUNCE_ADAPTIVE
+	if (!debounce.learned)
+	{
+		debounce.gap8 = gap << 3;
+		debounce.dev4 = gap << 1;
+		debounce.learned = true;
+	}
+	else
+	{
+		s32 err = (s32)gap - (s32)(debounce.gap8 >> 3);
+		debounce.gap8 += err;
+		debounce.dev4 += (err < 0 ? -err : err) - (s32)(debounce.dev4 >> 2);
+	}
+	u32 delay = (debounce.gap8 >> 3) + (debounce.dev4 >> 1);
+	debounce.delay_ms = MIN(MAX(delay, DISK_DEBOUNCE_MIN_MS), DISK_DEBOUNCE_MAX_MS);
+	DISK_STATS_SET(debounce_ms, debounce.delay_ms);
+#else
+	(void)gap;
 #endif
+}
 
-static HAL_StatusTypeDef erase_flash_page(u32 Address)
+// Called for every host write, before it is applied
+static void debounce_host_write(void)
 {
-	unsigned long page_error;
-	static FLASH_EraseInitTypeDef EraseInitStruct;
-	HAL_StatusTypeDef status;
+	u32 now = HAL_GetTick();
+	u32 gap = now - debounce.last_tick;
+
+	// A longer gap starts a new save: it neither counts nor widens the delay
+	if (gap < DISK_DEBOUNCE_MAX_MS && (debounce.writes || debounce.timed))
+	{
+		if (!debounce.writes)
+		{
+			// The delay ran out in the middle of a save: the host was still writing
+			DISK_STATS_ADD(early_commits, 1);
+		}
+		debounce.gap_max = MAX(debounce.gap_max, gap);
+		debounce.gaps++;
+	}
+	debounce.timed = false;
+	debounce.writes++;
+	debounce.last_tick = now;
+}
+
+// Credit the time since the last refill, then charge the erases done since
+static void budget_refill(void)
+{
+	u32 now = HAL_GetTick();
+
+	budget.credit += (int64_t)(now - budget.tick) * budget.rate;
+	budget.credit = MIN(budget.credit, (int64_t)budget.cap * BUDGET_ERASE);
+	budget.credit -= (int64_t)(flash_erases - budget.erases) * BUDGET_ERASE;
+	budget.tick = now;
+	budget.erases = flash_erases;
+}
+
+// ms until the budget can pay for erases, 0 = now
+static u32 budget_wait_ms(u32 erases)
+{
+	if (!BUDGET || budget.eject)
+	{
+		return 0;
+	}
+	budget_refill();
+	int64_t need = (int64_t)MIN(erases, budget.cap) * BUDGET_ERASE;
+	if (budget.credit >= need)
+	{
+		return 0;
+	}
+	return (u32)((need - budget.credit + budget.rate - 1) / budget.rate);
+}
 
-#if defined(STM32F103xB)
-	EraseInitStruct.TypeErase = FLASH_TYPEERASE_PAGES;
-	EraseInitStruct.PageAddress = Address;
-	EraseInitStruct.NbPages = 1;
-#elif defined(STM32F411xE)
-	EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
-	EraseInitStruct.Sector = GetSectorNumber(Address);
-	EraseInitStruct.NbSectors = 1;
-	EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3; // 2.7V - 3.6V
+static void budget_init(void)
+{
+	uintptr_t base;
+	u32 first = DiskFlash.unit(APP_BASE, NULL, NULL);
+	u32 last = DiskFlash.unit(APP_BASE + APP_SIZE - 1, &base, NULL);
+
+	memset(&budget, 0, sizeof(budget));
+	budget.units = first == DISK_FLASH_NONE || last == DISK_FLASH_NONE ? 1 : last - first + 1;
+	budget.rate = DISK_ERASE_BUDGET_PER_HOUR * 1000;
+#if DISK_LIFETIME_YEARS
+	// The whole region worn out evenly in DISK_LIFETIME_YEARS of 8766 hours
+	uint64_t life = (uint64_t)DiskFlash.geometry()->endurance * budget.units * 1000 / (DISK_LIFETIME_YEARS * 8766UL);
+	budget.rate = (u32)(budget.rate ? MIN(budget.rate, life) : life);
+	budget.rate = MAX(budget.rate, 1);
 #endif
+	budget.cap = MAX(DISK_ERASE_BUDGET_BURST, budget.units);
+	budget.credit = DISK_ERASE_BUDGET_BURST * BUDGET_ERASE;
+	budget.tick = budget.start_tick = HAL_GetTick();
+	budget.erases = budget.session_erases = flash_erases;
+}
+
+// flash interface functions
+static HAL_StatusTypeDef erase_flash_page(uintptr_t Address)
+{
+	HAL_StatusTypeDef status;
 
-	status = HAL_FLASHEx_Erase(&EraseInitStruct, &page_error);
+	DISK_TRACE_EVENT(ERASE_BEGIN, Address, 0);
+	DISK_PROF_BEGIN(FLASH_ERASE);
+	status = DiskFlash.erase(Address);
+	DISK_PROF_END(FLASH_ERASE);
+	DISK_TRACE_EVENT(ERASE_END, status, 0);
 	if (status != HAL_OK)
 	{
 		app_log_error("Unable to erase flash page: %d", status);
+		return status;
+	}
+	budget_refill(); // credit up to the erase, so the bucket does not depend on how often it is read
+	flash_erases++;
+	if (Address >= APP_BASE && Address < APP_BASE + DISK_STATS_PAGES * FLASH_PAGE_SIZE)
+	{
+		DISK_STATS_ADD(erases[(Address - APP_BASE) / FLASH_PAGE_SIZE], 1);
 	}
 	return status;
 }
-static HAL_StatusTypeDef write_flash_halfword(u32 Address, u16 Data)
+
+#if DISK_STORE_LOG || DISK_STORE_TLV || DISK_FLASH_SECTORS
+// Erase the units holding the user data region: the smallest the device has there
+static HAL_StatusTypeDef region_erase(void)
 {
-	HAL_StatusTypeDef status;
+	HAL_StatusTypeDef status = HAL_OK;
+	uintptr_t base;
+	u32 size;
 
-#if defined(STM32F103xB)
-	// https://stackoverflow.com/questions/28498191/cant-write-to-flash-memory-after-erase
-	// grr... looks like by default you can only write once to flash w/o clearing this...
-	CLEAR_BIT(FLASH->CR, (FLASH_CR_PG));
-	status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, Address, Data);
-#elif defined(STM32F411xE)
-	// F4 series uses word programming more efficiently, but halfword still works
-	status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, Address, Data);
+	for (uintptr_t addr = APP_BASE; addr < APP_BASE + APP_SIZE && status == HAL_OK; addr = base + size)
+	{
+		if (DiskFlash.unit(addr, &base, &size) == DISK_FLASH_NONE)
+		{
+			return HAL_ERROR;
+		}
+		status = erase_flash_page(base);
+	}
+	return status;
+}
 #endif
 
-	if (status != HAL_OK)
+// Program len bytes at addr, each operation as wide as the device, the voltage and the
+// alignment allow. A last piece shorter than DISK_FLASH_WRITE_MIN is padded with 0xFF.
+static HAL_StatusTypeDef write_flash(uintptr_t addr, const void *src, u32 len)
+{
+	const u8 *p = src;
+	u32 max = DiskFlash.width();
+	HAL_StatusTypeDef status = HAL_OK;
+
+	while (len && status == HAL_OK)
 	{
-		app_log_error("Unable to write halfword: %d", status);
+		u32 w = max;
+		u8 tail[8];
+		while (w > DISK_FLASH_WRITE_MIN && ((addr & (w - 1)) || len < w))
+		{
+			w >>= 1;
+		}
+		if (len < w)
+		{
+			memset(tail, 0xFF, sizeof(tail));
+			memcpy(tail, p, len);
+			p = tail;
+			len = w;
+		}
+		status = DiskFlash.program(addr, p, w);
+		if (status != HAL_OK)
+		{
+			app_log_error("Unable to program flash at 0x%lx: %d", addr, status);
+			DISK_STATS_ADD(program_errors, 1);
+		}
+		else
+		{
+			DISK_STATS_ADD(bytes_programmed, w);
+		}
+		addr += w;
+		p += w;
+		len -= w;
 	}
 	return status;
 }
-u8 rewrite_dirty_flash_pages(void)
+
+#if DISK_STORE_LOG || DISK_STORE_TLV || !DISK_FLASH_SECTORS
+// Program a header with its first bytes last, so one cut short by a reset never has them
+static HAL_StatusTypeDef write_flash_last(uintptr_t addr, const void *src, u32 len, u32 first)
+{
+	first = DISK_FLASH_ALIGN(first);
+	HAL_StatusTypeDef status = len > first ? write_flash(addr + first, (const u8 *)src + first, len - first) : HAL_OK;
+	return status == HAL_OK ? write_flash(addr, src, MIN(first, len)) : status;
+}
+#endif
+
+#if DISK_VERIFY
+static void verify_failed(uintptr_t addr, u32 len)
+{
+	app_log_warn("Flash at 0x%lx does not read back what was programmed", addr);
+	DISK_TRACE_EVENT(VERIFY_FAIL, addr, len);
+	DISK_STATS_ADD(verify_failures, 1);
+}
+#endif
+
+// Read back len bytes just programmed at addr, word-wise. False if flash does not hold them.
+static bool verify_flash(uintptr_t addr, const u8 *expect, u32 len)
+{
+#if DISK_VERIFY
+	DISK_PROF_BEGIN(FLASH_VERIFY);
+	bool same = !buffers_differ((const u8 *)addr, expect, len);
+	DISK_PROF_END(FLASH_VERIFY);
+	if (!same)
+	{
+		verify_failed(addr, len);
+	}
+	return same;
+#else
+	(void)addr;
+	(void)expect;
+	(void)len;
+	return true;
+#endif
+}
+#if DISK_STORE_LOG || DISK_STORE_TLV
+// Flash writer shared by the log formats: bytes are gathered into whole program operations
+static struct
 {
-	u32 i, j;
-	u16 *f_buff;
+	uintptr_t addr; // flash address of buf[0]
+	u8 buf[32];
+	u32 fill;
 	HAL_StatusTypeDef status;
+} store_out;
 
-	status = HAL_FLASH_Unlock();
-	if (status != HAL_OK)
+static void store_begin(uintptr_t addr)
+{
+	store_out.addr = addr;
+	store_out.fill = 0;
+}
+
+// Program what is left, the last operation padded with 0xFF
+static void store_flush(void)
+{
+	if (store_out.fill && write_flash(store_out.addr, store_out.buf, store_out.fill) != HAL_OK)
 	{
-		app_log_error("Unable to unlock flash: %d", status);
+		store_out.status = HAL_ERROR;
 	}
+	store_out.addr += DISK_FLASH_ALIGN(store_out.fill);
+	store_out.fill = 0;
+}
 
-#if defined(STM32F103xB)
-	// F1: Multiple 1KB pages
-	for (i = 0; i < 16; i++)
+static void store_program(const u8 *p, u32 n)
+{
+	while (n)
 	{
-		if (page_dirty_mask[i])
+		u32 k = MIN(n, sizeof(store_out.buf) - store_out.fill);
+		memcpy(store_out.buf + store_out.fill, p, k);
+		store_out.fill += k;
+		p += k;
+		n -= k;
+		if (store_out.fill == sizeof(store_out.buf))
 		{
-			page_dirty_mask[i] = 0;
-			erase_flash_page(APP_BASE + i * FLASH_PAGE_SIZE);
-			f_buff = (u16 *)&disk_buffer[i * FLASH_PAGE_SIZE];
-			for (j = 0; j < FLASH_PAGE_SIZE; j += 2)
-			{
-				if (write_flash_halfword((u32)(APP_BASE + i * FLASH_PAGE_SIZE + j), *f_buff++) != HAL_OK)
-				{
-					app_log_error("Unable to program flash at index %lu", j);
-				}
-			}
-			break;
+			store_flush();
 		}
 	}
-#elif defined(STM32F411xE)
-	// F4: Single 16KB sector - check if any page is dirty
-	for (i = 0; i < sizeof(page_dirty_mask); i++)
+}
+#endif
+
+#if DISK_STORE_LOG
+// Compressed image log (disk_store.h). The header goes in last, magic last of all, so a
+// record interrupted by a reset is never taken for a valid one.
+#define STORE_NONE 0xFFFFFFFFUL
+#define STORE_FILE_BYTES FILE_SECTOR_SIZE
+// Header and records padded to whole program operations: the payload and the next record
+// never share one with the header programmed last
+#define STORE_HEADER DISK_FLASH_ALIGN(sizeof(disk_store_record_t))
+#define STORE_ALIGN(n) DISK_FLASH_ALIGN(DISK_STORE_ALIGN(n))
+
+static u32 store_newest = STORE_NONE; // offset of the record disk_buffer was loaded from
+static u32 store_end;                 // offset of the first byte after the last record
+static u32 store_seq;
+
+static struct
+{
+	const u8 *ref; // dry run: payload of the newest record
+	u32 len;
+	u32 pos;
+	bool same;
+} store_cmp;
+
+#if STREAM_COMMIT
+// File sectors programmed ahead of the commit (DISK_STREAM_COMMIT): the file stream of the
+// next record from store_end + STORE_HEADER on, its unprogrammed tail still in store_out
+static struct
+{
+	u16 chunks; // sectors programmed, one compressed part each
+	u32 crc;    // CRC-32 of those sectors as programmed
+	u32 gen;    // pipe.gen they belong to
+	bool stale; // the host rewrote them, or programming failed: void them
+} stage;
+#endif
+
+static const disk_store_record_t *store_record(u32 offset)
+{
+	return (const disk_store_record_t *)(APP_BASE + offset);
+}
+
+static u32 store_record_size(const disk_store_record_t *r)
+{
+	return STORE_ALIGN(STORE_HEADER + r->meta_len + r->file_len);
+}
+
+// The streams of a record: a streamed record has the file stream first
+static const u8 *store_meta(const disk_store_record_t *r)
+{
+	return (const u8 *)r + STORE_HEADER + (r->chunks == DISK_STORE_UNCHUNKED ? 0 : r->file_len);
+}
+
+static const u8 *store_file(const disk_store_record_t *r)
+{
+	return (const u8 *)r + STORE_HEADER + (r->chunks == DISK_STORE_UNCHUNKED ? r->meta_len : 0);
+}
+
+// Compress disk_buffer into a record payload laid out for chunks, handing it to emit. The
+// first skip file sectors only advance the compressor: they are in flash already.
+static void store_payload(u16 chunks, u32 skip, void (*emit)(const u8 *p, u32 n), u16 *meta_len, u16 *file_len)
+{
+	if (chunks == DISK_STORE_UNCHUNKED)
 	{
-		if (page_dirty_mask[i])
+		*meta_len = DiskStore.compress(disk_buffer, META_BYTES, emit);
+		*file_len = DiskStore.compress(FILE_SECTOR, STORE_FILE_BYTES, emit);
+		return;
+	}
+	*file_len = 0;
+	for (u32 i = 0; i <= chunks; i++)
+	{
+		u32 end = i < chunks ? (i + 1) * SECTOR_SIZE : STORE_FILE_BYTES;
+		*file_len += DiskStore.compress_more(FILE_SECTOR, i * SECTOR_SIZE, end, i < skip ? NULL : emit);
+	}
+	*meta_len = DiskStore.compress(disk_buffer, META_BYTES, emit);
+}
+
+// Walk the log: store_newest becomes the last record starting below limit
+static void store_scan(u32 limit)
+{
+	u32 offset = 0;
+
+	store_newest = STORE_NONE;
+	while (offset + sizeof(disk_store_record_t) <= APP_SIZE)
+	{
+		const disk_store_record_t *r = store_record(offset);
+		if (r->magic != DISK_STORE_MAGIC || (r->raw_len != sizeof(disk_buffer) && r->raw_len != 0) ||
+			offset + store_record_size(r) > APP_SIZE)
 		{
-			// Erase the entire sector and rewrite all data
-			app_log_trace("Erasing flash sector...", NULL);
-			memset(page_dirty_mask, 0, sizeof(page_dirty_mask));
-			erase_flash_page(APP_BASE);
-			app_log_trace("Writing %u bytes to flash...", sizeof(disk_buffer));
-			f_buff = (u16 *)disk_buffer;
-			for (j = 0; j < sizeof(disk_buffer); j += 2)
-			{
-				if (write_flash_halfword((u32)(APP_BASE + j), *f_buff++) != HAL_OK)
-				{
-					app_log_error("Unable to program flash at index %lu", j);
-				}
-			}
-			app_log_trace("Flash write loop completed", NULL);
 			break;
 		}
+		if (offset < limit && r->raw_len) // not a void record
+		{
+			store_newest = offset;
+			store_seq = r->seq;
+		}
+		offset += store_record_size(r);
+	}
+	store_end = offset;
+}
+
+static bool store_decode(const disk_store_record_t *r)
+{
+	// With DISK_META_SYNTH the metadata stream is empty
+	return (META_BYTES == 0 || DiskStore.decompress(store_meta(r), r->meta_len, disk_buffer, META_BYTES)) &&
+		   DiskStore.decompress(store_file(r), r->file_len, FILE_SECTOR, STORE_FILE_BYTES) &&
+		   DiskStore.crc32(0, disk_buffer, sizeof(disk_buffer)) == r->crc;
+}
+
+static void store_load(void)
+{
+	u32 limit = APP_SIZE;
+
+#if STREAM_COMMIT
+	memset(&stage, 0, sizeof(stage)); // sectors programmed ahead without a header are lost
+#endif
+	for (store_scan(limit); store_newest != STORE_NONE; store_scan(limit))
+	{
+		if (store_decode(store_record(store_newest)))
+		{
+			app_log_debug("Loaded record %lu at 0x%lx", store_seq, store_newest);
+			return;
+		}
+		app_log_warn("Corrupt record at 0x%lx, trying the previous one", store_newest);
+		limit = store_newest;
+	}
+	if (store_end == 0)
+	{
+		// No log: blank flash, or a raw image written without DISK_STORE_LOG
+		memcpy(disk_buffer, (u8 *)APP_BASE, sizeof(disk_buffer));
+	}
+	else
+	{
+		memset(disk_buffer, 0xFF, sizeof(disk_buffer)); // as blank flash: init() creates defaults
+	}
+}
+
+// FILE_SECTOR only, for validate_file's recovery path
+static void store_load_file(void)
+{
+	if (store_newest == STORE_NONE)
+	{
+		memcpy(FILE_SECTOR, (u8 *)APP_BASE + META_BYTES, STORE_FILE_BYTES);
+		return;
+	}
+	const disk_store_record_t *r = store_record(store_newest);
+	if (!DiskStore.decompress(store_file(r), r->file_len, FILE_SECTOR, STORE_FILE_BYTES))
+	{
+		memset(FILE_SECTOR, 0, STORE_FILE_BYTES);
+	}
+}
+
+static void store_compare(const u8 *p, u32 n)
+{
+	store_cmp.same = store_cmp.same && store_cmp.pos + n <= store_cmp.len &&
+					 !buffers_differ(p, store_cmp.ref + store_cmp.pos, n);
+	store_cmp.pos += n;
+}
+
+// Read back the record just programmed at store_end: the header as is, the payload by
+// compressing the image again against it
+static bool store_verify(const disk_store_record_t *rec)
+{
+	const disk_store_record_t *r = store_record(store_end);
+
+	if (!verify_flash((uintptr_t)r, (const u8 *)rec, sizeof(*rec)))
+	{
+		return false;
+	}
+#if DISK_VERIFY
+	u16 meta_len, file_len;
+	DISK_PROF_BEGIN(FLASH_VERIFY);
+	store_cmp.ref = (const u8 *)r + STORE_HEADER;
+	store_cmp.len = rec->meta_len + rec->file_len;
+	store_cmp.pos = 0;
+	store_cmp.same = true;
+	store_payload(rec->chunks, 0, store_compare, &meta_len, &file_len);
+	DISK_PROF_END(FLASH_VERIFY);
+	if (!store_cmp.same || store_cmp.pos != store_cmp.len)
+	{
+		verify_failed((uintptr_t)store_cmp.ref, store_cmp.len);
+		return false;
+	}
+#endif
+	return true;
+}
+
+#if STREAM_COMMIT
+// Close the sectors programmed ahead with a void record the scan steps over. Flash must be
+// unlocked.
+static void store_void(void)
+{
+	store_flush();
+	disk_store_record_t rec = {
+		.magic = DISK_STORE_MAGIC,
+		.seq = store_seq,
+		.raw_len = 0,
+		.meta_len = 0,
+		.file_len = store_out.addr - (APP_BASE + store_end + STORE_HEADER),
+		.chunks = DISK_STORE_UNCHUNKED,
+		.crc = 0,
+	};
+	DISK_STATS_ADD(stream_voided, stage.chunks);
+	if (write_flash_last(APP_BASE + store_end, &rec, sizeof(rec), sizeof(rec.magic)) != HAL_OK)
+	{
+		app_log_error("Unable to void the sectors programmed ahead at 0x%lx", store_end);
+	}
+	store_end = MIN(store_end + store_record_size(&rec), APP_SIZE);
+	stage.chunks = 0;
+	stage.stale = false;
+}
+
+// Chunks of the next record: the sectors programmed ahead if the rendered file still starts
+// with them, otherwise they are voided and the record is not streamed
+static u16 stage_take(bool erase)
+{
+	if (stage.chunks == 0)
+	{
+		return DISK_STORE_UNCHUNKED;
+	}
+	if (!erase && !stage.stale && DiskStore.crc32(0, FILE_SECTOR, stage.chunks * SECTOR_SIZE) == stage.crc)
+	{
+		return stage.chunks;
+	}
+	if (erase)
+	{
+		stage.chunks = 0; // erased with the region
+	}
+	else
+	{
+		HAL_FLASH_Unlock();
+		store_void();
+		HAL_FLASH_Lock();
+	}
+	return DISK_STORE_UNCHUNKED;
+}
+#endif
+
+// Append disk_buffer as a new record, erasing the region first when it is full (or when
+// erase is set). An image identical to the newest record is not written again. File
+// sectors programmed ahead (DISK_STREAM_COMMIT) become the start of the record.
+static u8 store_commit(bool erase)
+{
+	const disk_store_record_t *newest = store_newest != STORE_NONE ? store_record(store_newest) : NULL;
+	disk_store_record_t rec = {
+		.magic = DISK_STORE_MAGIC,
+		.seq = store_seq + 1,
+		.raw_len = sizeof(disk_buffer),
+		.chunks = DISK_STORE_UNCHUNKED,
+		.crc = DiskStore.crc32(0, disk_buffer, sizeof(disk_buffer)),
+	};
+	u16 meta_len, file_len;
+	u32 ahead = 0; // file stream bytes already in flash
+
+#if STREAM_COMMIT
+	rec.chunks = stage_take(erase);
+#endif
+	// Dry run: sizes, and whether the newest record already holds this image
+	u16 newest_chunks = newest ? newest->chunks : DISK_STORE_UNCHUNKED;
+	store_cmp.ref = newest ? (const u8 *)newest + STORE_HEADER : NULL;
+	store_cmp.len = newest ? newest->meta_len + newest->file_len : 0;
+	store_cmp.pos = 0;
+	store_cmp.same = newest != NULL;
+	store_payload(newest_chunks, 0, store_compare, &meta_len, &file_len);
+	bool same = store_cmp.same && store_cmp.pos == store_cmp.len && newest->meta_len == meta_len;
+	if (rec.chunks == newest_chunks)
+	{
+		rec.meta_len = meta_len;
+		rec.file_len = file_len;
+	}
+	else
+	{
+		store_payload(rec.chunks, 0, NULL, &rec.meta_len, &rec.file_len);
+	}
+
+	u32 size = STORE_ALIGN(STORE_HEADER + rec.meta_len + rec.file_len);
+#if STREAM_COMMIT
+	if (rec.chunks != DISK_STORE_UNCHUNKED && (same || store_end + size > APP_SIZE))
+	{
+		// Unchanged after all, or the log restarts: the sectors programmed ahead go unused
+		stage.stale = true;
+		rec.chunks = stage_take(!same);
+		store_payload(rec.chunks, 0, NULL, &rec.meta_len, &rec.file_len);
+		size = STORE_ALIGN(STORE_HEADER + rec.meta_len + rec.file_len);
+	}
+	if (rec.chunks != DISK_STORE_UNCHUNKED)
+	{
+		ahead = store_out.addr - (APP_BASE + store_end + STORE_HEADER);
+	}
+#endif
+	if (!erase && same)
+	{
+		return HAL_OK;
+	}
+
+	if (size > APP_SIZE)
+	{
+		app_log_error("Compressed image of %lu bytes does not fit the user data region", size);
+		return HAL_ERROR;
+	}
+
+	if (HAL_FLASH_Unlock() != HAL_OK)
+	{
+		app_log_error("Unable to unlock flash", NULL);
+	}
+	if (erase || store_end + size > APP_SIZE || !swar_is_fill((u8 *)APP_BASE + store_end, STORE_HEADER, 0xFF) ||
+		!swar_is_fill((u8 *)APP_BASE + store_end + STORE_HEADER + ahead, size - STORE_HEADER - ahead, 0xFF))
+	{
+		store_end = 0;
+		ahead = 0;
+		if (region_erase() != HAL_OK)
+		{
+			HAL_FLASH_Lock();
+			return HAL_ERROR;
+		}
+	}
+
+	DISK_TRACE_EVENT(STORE_APPEND, size, store_end);
+	DISK_TRACE_EVENT(PROGRAM_BEGIN, size - ahead, APP_BASE + store_end);
+	DISK_PROF_BEGIN(FLASH_PROGRAM);
+	if (ahead == 0)
+	{
+		store_begin(APP_BASE + store_end + STORE_HEADER);
+		store_out.status = HAL_OK;
+	}
+	store_payload(rec.chunks, ahead ? rec.chunks : 0, store_program, &meta_len, &file_len);
+	store_flush();
+	if (store_out.status == HAL_OK)
+	{
+		store_out.status = write_flash_last(APP_BASE + store_end, &rec, sizeof(rec), sizeof(rec.magic));
+	}
+	DISK_PROF_END(FLASH_PROGRAM);
+	DISK_TRACE_EVENT(PROGRAM_END, 0, 0);
+	if (store_out.status == HAL_OK && !store_verify(&rec))
+	{
+		store_out.status = HAL_ERROR;
+	}
+#if STREAM_COMMIT
+	if (ahead)
+	{
+		DISK_STATS_ADD(streamed_commits, 1);
+		DISK_STATS_ADD(streamed_sectors, rec.chunks);
 	}
+	stage.chunks = 0;
 #endif
 
 	if (HAL_FLASH_Lock() != HAL_OK)
 	{
-		app_log_error("Unable to lock flash", NULL);
+		app_log_error("Unable to lock flash", NULL);
+	}
+	if (store_out.status != HAL_OK)
+	{
+		app_log_error("Unable to program record at 0x%lx", store_end);
+		// The next commit starts behind the broken record if the scan can step over it
+		// (its CRC keeps it from being loaded), otherwise the log starts over
+		bool header_ok = !buffers_differ((const u8 *)store_record(store_end), (const u8 *)&rec, sizeof(rec));
+		store_end = header_ok ? store_end + size : APP_SIZE;
+		return store_out.status;
+	}
+	store_newest = store_end;
+	store_seq = rec.seq;
+	store_end += size;
+	return HAL_OK;
+}
+
+#if ERASE_AHEAD || BUDGET
+// The next commit is likely to restart the log: a record twice the size of the newest one
+// would not fit behind it, and restarting makes room for one
+static bool store_restarts(void)
+{
+	u32 size = store_newest != STORE_NONE ? store_record_size(store_record(store_newest)) : 0;
+
+	return size != 0 && size + 2 * size <= APP_SIZE &&
+		   (store_end + 2 * size > APP_SIZE || !swar_is_fill((u8 *)APP_BASE + store_end, 2 * size, 0xFF));
+}
+#endif
+
+#if ERASE_AHEAD
+// Restart the log now if the next commit would, so that commit only programs
+static void store_prepare(void)
+{
+	if (!store_restarts())
+	{
+		return;
+	}
+	if (store_commit(true) != HAL_OK)
+	{
+		app_log_error("Unable to restart the store log ahead of the next commit", NULL);
+	}
+}
+#endif
+#endif
+
+#if DISK_STORE_TLV
+#if DISK_STORE_LOG
+#error "DISK_STORE_LOG and DISK_STORE_TLV are alternative flash formats, enable one of them"
+#endif
+// Binary config store (disk_tlv.h)
+#define TLV_NONE 0xFFFFFFFFUL
+#define TLV_ALIGN(n) DISK_FLASH_ALIGN(DISK_TLV_ALIGN(n)) // whole program operations
+#define TLV_COMMIT_SIZE TLV_ALIGN(sizeof(disk_tlv_record_t) + sizeof(u32))
+
+static u16 tlv_keys[FILE_ENTRY_CNT];   // set by register_entry()
+static u32 tlv_latest[FILE_ENTRY_CNT]; // offset of each entry's newest committed record
+static u32 tlv_end;                    // offset of the first byte after the last record
+static u32 tlv_committed_end;          // same, for the last commit record
+static u32 tlv_seq;                    // number of the last commit, 0 = nothing stored
+static u32 tlv_oldest;                 // number of the first commit still in the log
+
+static const disk_tlv_record_t *tlv_record(u32 offset)
+{
+	return (const disk_tlv_record_t *)(APP_BASE + offset);
+}
+
+static u32 tlv_record_size(const disk_tlv_record_t *r)
+{
+	return TLV_ALIGN(sizeof(*r) + r->len);
+}
+
+static u16 tlv_crc(u16 key, const u8 *value, u32 len)
+{
+	return DiskStore.crc32(DiskStore.crc32(0, (const u8 *)&key, sizeof(key)), value, len);
+}
+
+static u16 tlv_key(const char *name)
+{
+	u16 key = DiskStore.crc32(0, (const u8 *)name, strlen(name));
+	return key == DISK_TLV_KEY_COMMIT || key == DISK_TLV_KEY_ERASED ? key ^ 0x5A5A : key;
+}
+
+// Index of the registered entry stored under key, -1 if none
+static int tlv_entry(u16 key)
+{
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		if (entries[k].entry[0] != '\0' && tlv_keys[k] == key)
+		{
+			return k;
+		}
+	}
+	return -1;
+}
+
+static bool tlv_is_commit(const disk_tlv_record_t *r)
+{
+	return r->key == DISK_TLV_KEY_COMMIT && r->type == DISK_TLV_COMMIT && r->len == sizeof(u32);
+}
+
+// Walk the log up to the first erased or broken record. Entry records only count once
+// the commit record behind them is found.
+static void tlv_scan(void)
+{
+	u32 offset = 0, k;
+	u32 pending[FILE_ENTRY_CNT];
+
+	tlv_seq = 0;
+	tlv_oldest = 0;
+	tlv_committed_end = 0;
+	for (k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		tlv_latest[k] = pending[k] = TLV_NONE;
+	}
+	while (offset + sizeof(disk_tlv_record_t) <= APP_SIZE)
+	{
+		const disk_tlv_record_t *r = tlv_record(offset);
+		if (r->key == DISK_TLV_KEY_ERASED || offset + tlv_record_size(r) > APP_SIZE ||
+			r->crc != tlv_crc(r->key, (const u8 *)(r + 1), r->len))
+		{
+			break;
+		}
+		if (tlv_is_commit(r))
+		{
+			memcpy(tlv_latest, pending, sizeof(pending));
+			memcpy(&tlv_seq, r + 1, sizeof(tlv_seq));
+			tlv_oldest = tlv_oldest ? tlv_oldest : tlv_seq;
+			tlv_committed_end = offset + tlv_record_size(r);
+		}
+		else if (r->type == DISK_TLV_TEXT && tlv_entry(r->key) >= 0)
+		{
+			pending[tlv_entry(r->key)] = offset;
+		}
+		offset += tlv_record_size(r);
+	}
+	tlv_end = offset;
+}
+
+// Offsets of every entry's record as of commit generation, and the end of that commit
+// record. Only walks the part tlv_scan() has checked. False if the log no longer holds it.
+static bool tlv_lookup(u32 generation, u32 offsets[FILE_ENTRY_CNT], u32 *commit_end)
+{
+	u32 offset = 0, seq, k;
+	u32 pending[FILE_ENTRY_CNT];
+
+	for (k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		pending[k] = TLV_NONE;
+	}
+	while (offset < tlv_committed_end)
+	{
+		const disk_tlv_record_t *r = tlv_record(offset);
+		offset += tlv_record_size(r);
+		if (tlv_is_commit(r))
+		{
+			memcpy(&seq, r + 1, sizeof(seq));
+			if (seq == generation)
+			{
+				memcpy(offsets, pending, sizeof(pending));
+				*commit_end = offset;
+				return true;
+			}
+		}
+		else if (r->type == DISK_TLV_TEXT && tlv_entry(r->key) >= 0)
+		{
+			pending[tlv_entry(r->key)] = offset - tlv_record_size(r);
+		}
+	}
+	return false;
+}
+
+// Copy the newest keep generations that fit in limit bytes into file_buffer, as the start
+// of the compacted log: a full snapshot of the oldest one kept, its commit record, then the
+// later commits as they are in the log. Returns the length, 0 if not even one fits.
+static u32 tlv_stage_history(u32 limit, u32 keep)
+{
+	u32 offsets[FILE_ENTRY_CNT], commit_end, len, k;
+	u32 first = tlv_seq >= keep ? tlv_seq - keep + 1 : 1;
+
+	limit = MIN(limit, sizeof(file_buffer));
+	for (u32 g = MAX(first, tlv_oldest); tlv_seq && g <= tlv_seq; g++)
+	{
+		if (!tlv_lookup(g, offsets, &commit_end))
+		{
+			continue;
+		}
+		len = TLV_COMMIT_SIZE + (tlv_committed_end - commit_end);
+		for (k = 0; k < FILE_ENTRY_CNT; k++)
+		{
+			len += offsets[k] != TLV_NONE ? tlv_record_size(tlv_record(offsets[k])) : 0;
+		}
+		if (len > limit)
+		{
+			continue;
+		}
+		len = 0;
+		for (k = 0; k < FILE_ENTRY_CNT; k++)
+		{
+			if (offsets[k] != TLV_NONE)
+			{
+				u32 size = tlv_record_size(tlv_record(offsets[k]));
+				memcpy(file_buffer + len, tlv_record(offsets[k]), size);
+				len += size;
+			}
+		}
+		memcpy(file_buffer + len, (const u8 *)APP_BASE + commit_end - TLV_COMMIT_SIZE,
+			   TLV_COMMIT_SIZE + (tlv_committed_end - commit_end));
+		return len + TLV_COMMIT_SIZE + (tlv_committed_end - commit_end);
+	}
+	return 0;
+}
+
+// Erase the region and program the first len bytes of file_buffer back as the log;
+// HAL_ERROR if they did not read back
+static HAL_StatusTypeDef tlv_rewrite(u32 len)
+{
+	if (region_erase() != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+	store_begin(APP_BASE);
+	store_out.status = HAL_OK;
+	store_program(file_buffer, len);
+	store_flush();
+	if (store_out.status == HAL_OK && !verify_flash(APP_BASE, file_buffer, len))
+	{
+		store_out.status = HAL_ERROR;
+	}
+	tlv_end = len;
+	return store_out.status;
+}
+
+// Entry k's value as last rendered into parse_buffer[k] ("ENTRY=value")
+static const u8 *tlv_value(u32 k, u32 *len)
+{
+	size_t name_len = strlen(entries[k].entry);
+	const u8 *line = parse_buffer[k];
+
+	if (entries[k].entry[0] == '\0' || memcmp(line, entries[k].entry, name_len) != 0 || line[name_len] != '=')
+	{
+		return NULL;
+	}
+	*len = strlen((const char *)line + name_len + 1);
+	return line + name_len + 1;
+}
+
+static void tlv_append(u16 key, u8 type, const u8 *value, u32 len)
+{
+	disk_tlv_record_t rec = {key, len, type, 0xFF, tlv_crc(key, value, len)};
+
+	store_begin(APP_BASE + tlv_end + sizeof(rec));
+	store_program(value, len);
+	store_flush();
+	if (store_out.status == HAL_OK)
+	{
+		store_out.status = write_flash_last(APP_BASE + tlv_end, &rec, sizeof(rec), sizeof(rec.key)); // key last
+	}
+	if (store_out.status == HAL_OK && !(verify_flash(APP_BASE + tlv_end, (const u8 *)&rec, sizeof(rec)) &&
+										 verify_flash(APP_BASE + tlv_end + sizeof(rec), value, len)))
+	{
+		store_out.status = HAL_ERROR;
+	}
+	tlv_end += tlv_record_size(&rec);
+}
+
+// Append a record for every entry whose value changed, then the commit record. With
+// compact set, or when the region is full, erase it and write every entry again.
+static u8 tlv_commit(bool compact)
+{
+	u32 changed = 0, all = 0, changed_bytes = 0, all_bytes = 0, len, k;
+	u32 offsets[FILE_ENTRY_CNT];
+	u32 seq = tlv_seq + 1;
+
+	for (k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		const u8 *value = tlv_value(k, &len);
+		if (value == NULL)
+		{
+			continue;
+		}
+		const disk_tlv_record_t *r = tlv_latest[k] != TLV_NONE ? tlv_record(tlv_latest[k]) : NULL;
+		u32 size = TLV_ALIGN(sizeof(disk_tlv_record_t) + len);
+		bitSet(all, k);
+		all_bytes += size;
+		if (r == NULL || r->len != len || buffers_differ(value, (const u8 *)(r + 1), len))
+		{
+			bitSet(changed, k);
+			changed_bytes += size;
+		}
+	}
+	if (changed == 0 && !compact)
+	{
+		return HAL_OK;
+	}
+	if (tlv_end != tlv_committed_end)
+	{
+		// Records of an interrupted commit follow the last commit record: write every
+		// entry again so the next commit record cannot adopt any of them
+		changed = all;
+		changed_bytes = all_bytes;
+	}
+
+	if (HAL_FLASH_Unlock() != HAL_OK)
+	{
+		app_log_error("Unable to unlock flash", NULL);
+	}
+	bool compacted = false;
+	if (compact || tlv_end + changed_bytes + TLV_COMMIT_SIZE > APP_SIZE ||
+		!swar_is_fill((u8 *)APP_BASE + tlv_end, changed_bytes + TLV_COMMIT_SIZE, 0xFF))
+	{
+		// History may take half the region, so compaction stays rare
+		u32 history = tlv_stage_history(APP_SIZE / 2, DISK_TLV_HISTORY - 1);
+		if (all_bytes + TLV_COMMIT_SIZE > APP_SIZE || tlv_rewrite(history) != HAL_OK)
+		{
+			app_log_error("Unable to compact the config store", NULL);
+			HAL_FLASH_Lock();
+			tlv_scan();
+			return HAL_ERROR;
+		}
+		if (history == 0)
+		{
+			changed = all;
+			changed_bytes = all_bytes;
+		}
+		compacted = true;
+	}
+
+	DISK_TRACE_EVENT(STORE_APPEND, changed_bytes + TLV_COMMIT_SIZE, tlv_end);
+	DISK_TRACE_EVENT(PROGRAM_BEGIN, changed_bytes + TLV_COMMIT_SIZE, APP_BASE + tlv_end);
+	DISK_PROF_BEGIN(FLASH_PROGRAM);
+	store_out.status = HAL_OK;
+	for (k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		offsets[k] = tlv_latest[k];
+		if (bitRead(changed, k))
+		{
+			const u8 *value = tlv_value(k, &len);
+			offsets[k] = tlv_end;
+			tlv_append(tlv_keys[k], DISK_TLV_TEXT, value, len);
+		}
+	}
+	tlv_append(DISK_TLV_KEY_COMMIT, DISK_TLV_COMMIT, (const u8 *)&seq, sizeof(seq));
+	DISK_PROF_END(FLASH_PROGRAM);
+	DISK_TRACE_EVENT(PROGRAM_END, 0, 0);
+
+	if (HAL_FLASH_Lock() != HAL_OK)
+	{
+		app_log_error("Unable to lock flash", NULL);
+	}
+	if (store_out.status != HAL_OK || compacted)
+	{
+		// After compaction the unchanged entries live at new offsets: walk the new log
+		tlv_scan();
+		if (tlv_seq != seq)
+		{
+			app_log_error("Unable to program config commit %lu", seq);
+			return HAL_ERROR;
+		}
+		return HAL_OK;
+	}
+	memcpy(tlv_latest, offsets, sizeof(offsets));
+	tlv_seq = seq;
+	tlv_committed_end = tlv_end;
+	return HAL_OK;
+}
+
+#if ERASE_AHEAD || BUDGET
+// Whether the next commit fits behind the log even if every entry changes; *need: its size
+static bool tlv_fits(u32 *need)
+{
+	u32 len;
+
+	*need = TLV_COMMIT_SIZE;
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		if (tlv_value(k, &len) != NULL)
+		{
+			*need += TLV_ALIGN(sizeof(disk_tlv_record_t) + len);
+		}
+	}
+	return tlv_end == tlv_committed_end && tlv_end + *need <= APP_SIZE &&
+		   swar_is_fill((u8 *)APP_BASE + tlv_end, *need, 0xFF);
+}
+#endif
+
+#if ERASE_AHEAD
+// Compact the log now if the next commit might not fit behind it, leaving room for every
+// entry to change, so that commit only programs
+static void tlv_prepare(void)
+{
+	u32 need, seq = tlv_seq;
+
+	if (tlv_fits(&need))
+	{
+		return;
+	}
+	// No commit is added, so the newest one counts towards the history kept
+	u32 history = tlv_stage_history(APP_SIZE / 2, DISK_TLV_HISTORY);
+	if (history == 0 || history + need > APP_SIZE)
+	{
+		return; // the commit compacts and writes every entry itself
+	}
+	if (HAL_FLASH_Unlock() != HAL_OK)
+	{
+		app_log_error("Unable to unlock flash", NULL);
+	}
+	HAL_StatusTypeDef status = tlv_rewrite(history);
+	if (HAL_FLASH_Lock() != HAL_OK)
+	{
+		app_log_error("Unable to lock flash", NULL);
+	}
+	tlv_scan();
+	if (status != HAL_OK || tlv_seq != seq)
+	{
+		app_log_error("Unable to compact the config store ahead of commit %lu", seq + 1);
+	}
+}
+#endif
+
+// CONFIG.TXT text from the newest committed values, for validate_file's recovery path
+static void tlv_load_file(void)
+{
+	u32 m = 0;
+
+	memset(FILE_SECTOR, 0, FILE_SECTOR_SIZE);
+	for (u32 k = 0; k < FILE_ENTRY_CNT && m < FILE_SECTOR_SIZE; k++)
+	{
+		if (entries[k].entry[0] != '\0' && tlv_latest[k] != TLV_NONE)
+		{
+			const disk_tlv_record_t *r = tlv_record(tlv_latest[k]);
+			m += snprintf((char *)FILE_SECTOR + m, FILE_SECTOR_SIZE - m, "%s=%.*s\r\n", entries[k].entry,
+						  (int)r->len, (const char *)(r + 1));
+		}
+	}
+}
+#endif
+
+#if !DISK_STORE_LOG && !DISK_STORE_TLV
+// Raw image placement: image page i lives in region page page_map[i]. On page devices
+// (F103, L4, G0) the page map below rotates pages for wear; on F4 an image that keeps
+// failing moves to another slot of its sector.
+#define IMAGE_PAGES ((sizeof(disk_buffer) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+#define REGION_PAGES (APP_SIZE / FLASH_PAGE_SIZE)
+
+static u8 page_map[IMAGE_PAGES];
+
+static uintptr_t image_page(u32 i)
+{
+	return APP_BASE + page_map[i] * FLASH_PAGE_SIZE;
+}
+
+static u32 image_page_len(u32 i)
+{
+	return MIN(FLASH_PAGE_SIZE, sizeof(disk_buffer) - i * FLASH_PAGE_SIZE);
+}
+
+// Copy len bytes of the stored image from offset, page by page through page_map
+static void image_read(u8 *dst, u32 offset, u32 len)
+{
+	while (len)
+	{
+		u32 n = MIN(len, FLASH_PAGE_SIZE - offset % FLASH_PAGE_SIZE);
+		memcpy(dst, (const u8 *)image_page(offset / FLASH_PAGE_SIZE) + offset % FLASH_PAGE_SIZE, n);
+		dst += n;
+		offset += n;
+		len -= n;
+	}
+}
+
+// Program image page i from disk_buffer into its (erased) region page and read it back
+static bool image_program(u32 i)
+{
+	u32 len = image_page_len(i);
+
+	DISK_TRACE_EVENT(PROGRAM_BEGIN, len, image_page(i));
+	DISK_PROF_BEGIN(FLASH_PROGRAM);
+	HAL_StatusTypeDef status = write_flash(image_page(i), &disk_buffer[i * FLASH_PAGE_SIZE], len);
+	DISK_PROF_END(FLASH_PROGRAM);
+	DISK_TRACE_EVENT(PROGRAM_END, 0, 0);
+	return status == HAL_OK && verify_flash(image_page(i), &disk_buffer[i * FLASH_PAGE_SIZE], len);
+}
+
+#if !DISK_FLASH_SECTORS
+// Page map. The last MAP_PAGES region pages hold the map, the pages not holding image data
+// are free. A changed image page is programmed into the least-erased free page and only
+// then does the map point at it, so the old copy stays valid until the map entry is
+// programmed; FAT and directory, which change on every save, rotate over the region.
+// Map page: map_snapshot_t, magic last, then one half-word per move (padded to
+// DISK_FLASH_WRITE_MIN): image page << 8 | region page, or MAP_BAD << 8 | region page for a
+// retired page. When one map page is
+// full the other is erased and gets a snapshot with the next seq. Needs at least one free
+// page, below that pages are rewritten in place; only the first 64 pages are used.
+#define MAP_PAGES 2
+#define MAP_MAX_PAGES 64
+#define MAP_MAGIC 0x50414D57UL // "WMAP"
+#define MAP_BAD 0xFE
+#define MAP_NONE 0xFFFFFFFFUL
+#define MAP_ENTRY DISK_FLASH_ALIGN(sizeof(u16))
+#define MAP_HEADER DISK_FLASH_ALIGN(sizeof(map_snapshot_t))
+#define MAP_REGION MIN(REGION_PAGES, MAP_MAX_PAGES) // a larger region only uses its first pages
+
+typedef struct {
+	u32 magic;
+	u32 seq;
+	uint64_t bad;              // retired region pages
+	u16 erases[MAP_MAX_PAGES]; // erase cycles of each region page
+	u8 map[IMAGE_PAGES];
+} map_snapshot_t;
+
+static bool map_active; // the region has room for the map and a free page
+static u16 map_erases[MAP_MAX_PAGES];
+static uint64_t map_bad;
+static u32 map_seq;
+static u32 map_cur = MAP_NONE; // region page of the map being appended to
+static u32 map_end;            // offset of its next entry
+
+static const u8 *region_page(u32 p)
+{
+	return (const u8 *)APP_BASE + p * FLASH_PAGE_SIZE;
+}
+
+static void map_count_erase(u32 p)
+{
+	map_erases[p] += map_erases[p] != 0xFFFF;
+}
+
+static void page_map_load(void)
+{
+	u32 i, p;
+
+	for (i = 0; i < IMAGE_PAGES; i++)
+	{
+		page_map[i] = i;
+	}
+	memset(map_erases, 0, sizeof(map_erases));
+	map_bad = 0;
+	map_seq = 0;
+	map_cur = MAP_NONE;
+	map_active = MAP_REGION > IMAGE_PAGES + MAP_PAGES;
+	if (!map_active)
+	{
+		return;
+	}
+	for (p = MAP_REGION - MAP_PAGES; p < MAP_REGION; p++)
+	{
+		const map_snapshot_t *s = (const map_snapshot_t *)region_page(p);
+		if (s->magic == MAP_MAGIC && s->seq > map_seq)
+		{
+			map_seq = s->seq;
+			map_cur = p;
+		}
+	}
+	if (map_cur == MAP_NONE)
+	{
+		return; // no map yet: the image is where a build without it put it
+	}
+	const map_snapshot_t *s = (const map_snapshot_t *)region_page(map_cur);
+	memcpy(page_map, s->map, sizeof(page_map));
+	memcpy(map_erases, s->erases, sizeof(map_erases));
+	map_bad = s->bad;
+	for (map_end = MAP_HEADER; map_end + MAP_ENTRY <= FLASH_PAGE_SIZE; map_end += MAP_ENTRY)
+	{
+		u16 entry = *(const u16 *)(region_page(map_cur) + map_end);
+		u32 page = entry >> 8, p = entry & 0xFF;
+		if (entry == 0xFFFF)
+		{
+			break;
+		}
+		if (page < IMAGE_PAGES && p < MAP_REGION - MAP_PAGES)
+		{
+			page_map[page] = p;
+			map_count_erase(p);
+		}
+		else if (page == MAP_BAD && p < MAP_REGION)
+		{
+			map_bad |= 1ULL << p;
+		}
+	}
+}
+
+// Start the other map page with a snapshot of the map as it is in RAM
+static void map_snapshot(void)
+{
+	u32 p = map_cur == MAP_REGION - MAP_PAGES ? MAP_REGION - 1 : MAP_REGION - MAP_PAGES;
+	map_snapshot_t s;
+
+	if (erase_flash_page((uintptr_t)region_page(p)) != HAL_OK)
+	{
+		return;
+	}
+	map_count_erase(p);
+	memset(&s, 0xFF, sizeof(s));
+	s.magic = MAP_MAGIC;
+	s.seq = map_seq + 1;
+	s.bad = map_bad;
+	memcpy(s.erases, map_erases, sizeof(s.erases));
+	memcpy(s.map, page_map, sizeof(s.map));
+	HAL_StatusTypeDef status = write_flash_last((uintptr_t)region_page(p), &s, sizeof(s), sizeof(s.magic));
+	if (status != HAL_OK || !verify_flash((uintptr_t)region_page(p), (const u8 *)&s, sizeof(s)))
+	{
+		app_log_error("Unable to program the page map at 0x%lx", (uintptr_t)region_page(p));
+		return;
+	}
+	map_cur = p;
+	map_seq = s.seq;
+	map_end = MAP_HEADER;
+}
+
+// Record a map change already made in RAM
+static void map_append(u32 page, u32 p)
+{
+	u16 entry = page << 8 | p;
+
+	if (map_cur == MAP_NONE || map_end + MAP_ENTRY > FLASH_PAGE_SIZE)
+	{
+		map_snapshot(); // holds the change
+		return;
+	}
+	if (write_flash((uintptr_t)region_page(map_cur) + map_end, &entry, sizeof(entry)) != HAL_OK)
+	{
+		app_log_error("Unable to program a page map entry", NULL);
+	}
+	map_end += MAP_ENTRY;
+}
+
+// Free region page with the fewest (or the most) erase cycles, MAP_NONE if there is none
+static u32 map_free_page(bool most)
+{
+	uint64_t used = map_bad;
+	u32 best = MAP_NONE;
+
+	for (u32 i = 0; i < IMAGE_PAGES; i++)
+	{
+		used |= 1ULL << page_map[i];
+	}
+	for (u32 p = 0; p < MAP_REGION - MAP_PAGES; p++)
+	{
+		if (!((used >> p) & 1) &&
+			(best == MAP_NONE || (most ? map_erases[p] > map_erases[best] : map_erases[p] < map_erases[best])))
+		{
+			best = p;
+		}
+	}
+	return best;
+}
+
+static void map_retire(u32 p)
+{
+	app_log_warn("Retiring flash page 0x%lx", (uintptr_t)region_page(p));
+	DISK_TRACE_EVENT(PAGE_RETIRED, (uintptr_t)region_page(p), 0);
+	DISK_STATS_ADD(retired_pages, 1);
+	map_bad |= 1ULL << p;
+	map_append(MAP_BAD, p);
+}
+
+// Move image page i to a free page: the least-erased one, or the most-erased one for
+// cold data. A page that does not read back after DISK_VERIFY_RETRIES more attempts is
+// retired and the next free page is tried.
+static HAL_StatusTypeDef map_write_page(u32 i, bool most)
+{
+	u32 old = page_map[i], p;
+
+	while ((p = map_free_page(most)) != MAP_NONE)
+	{
+		page_map[i] = p;
+		for (u32 attempt = 0; attempt <= DISK_VERIFY_RETRIES; attempt++)
+		{
+			if (erase_flash_page((uintptr_t)region_page(p)) != HAL_OK)
+			{
+				continue;
+			}
+			map_count_erase(p);
+			if (image_program(i))
+			{
+				map_append(i, p);
+				return HAL_OK;
+			}
+		}
+		page_map[i] = old;
+		map_retire(p);
+	}
+	app_log_error("No free flash page left for image page %lu", i);
+	return HAL_ERROR;
+}
+
+// Static wear leveling: once a free page has DISK_WEAR_SPREAD more erase cycles than the
+// least-erased page holding image data, move that (rarely changing) page onto the most
+// worn free page, so its own page joins the rotation
+static void map_level(void)
+{
+	u32 cold = 0, worn = map_free_page(true);
+
+	for (u32 i = 1; i < IMAGE_PAGES; i++)
+	{
+		cold = map_erases[page_map[i]] < map_erases[page_map[cold]] ? i : cold;
+	}
+	if (worn != MAP_NONE && map_erases[worn] >= map_erases[page_map[cold]] + DISK_WEAR_SPREAD &&
+		map_erases[map_free_page(false)] > map_erases[page_map[cold]])
+	{
+		app_log_debug("Moving image page %lu off flash page 0x%lx for wear", cold, image_page(cold));
+		map_write_page(cold, true);
+	}
+}
+
+// Rewrite image page i where it is: erase and program, DISK_VERIFY_RETRIES more times if
+// it does not read back. Used when the region has no room for the page map.
+static HAL_StatusTypeDef image_write_page(u32 i)
+{
+	if (map_active)
+	{
+		return map_write_page(i, false);
+	}
+	for (u32 attempt = 0; attempt <= DISK_VERIFY_RETRIES; attempt++)
+	{
+		if (erase_flash_page(image_page(i)) == HAL_OK && image_program(i))
+		{
+			return HAL_OK;
+		}
+	}
+	return HAL_ERROR;
+}
+#else
+// Bad slot retirement. The image takes one 16KB slot of the sector (128KB on F4's last
+// sectors). The other slots
+// are spares, except the last one, which holds the remap table: REMAP_MAGIC, then one
+// half-word per retired slot naming the image page moved to spare n (slot
+// IMAGE_PAGES + n). The sector is erased on every commit, so the table is programmed
+// again after each erase.
+#define SPARE_PAGES (REGION_PAGES > IMAGE_PAGES + 1 ? REGION_PAGES - IMAGE_PAGES - 1 : 0)
+#define REMAP_TABLE (APP_BASE + (REGION_PAGES - 1) * FLASH_PAGE_SIZE)
+#define REMAP_MAGIC 0x50414D52UL // "RMAP"
+
+static u32 remap_cnt; // spares in use
+
+static void page_map_load(void)
+{
+	const u16 *table = (const u16 *)(REMAP_TABLE + sizeof(u32));
+
+	for (u32 i = 0; i < IMAGE_PAGES; i++)
+	{
+		page_map[i] = i;
+	}
+	remap_cnt = 0;
+	if (SPARE_PAGES == 0 || *(const u32 *)REMAP_TABLE != REMAP_MAGIC)
+	{
+		return;
+	}
+	while (remap_cnt < SPARE_PAGES && table[remap_cnt] < IMAGE_PAGES)
+	{
+		page_map[table[remap_cnt]] = IMAGE_PAGES + remap_cnt;
+		remap_cnt++;
+	}
+}
+
+// Program table entry n, and the magic ahead of the first one
+static HAL_StatusTypeDef remap_program(u32 n)
+{
+	HAL_StatusTypeDef status = HAL_OK;
+	u32 magic = REMAP_MAGIC;
+	u16 page = 0;
+
+	while (page_map[page] != IMAGE_PAGES + n)
+	{
+		page++;
+	}
+	if (n == 0)
+	{
+		status = write_flash(REMAP_TABLE, &magic, sizeof(magic));
+	}
+	status = status == HAL_OK ? write_flash(REMAP_TABLE + sizeof(u32) + n * 2, &page, sizeof(page)) : status;
+	return status == HAL_OK && verify_flash(REMAP_TABLE + sizeof(u32) + n * 2, (const u8 *)&page, sizeof(page))
+			   ? HAL_OK
+			   : HAL_ERROR;
+}
+
+// Move image page i to the next spare slot, still erased from this commit. False if none
+// is left.
+static bool remap_retire(u32 i)
+{
+	if (remap_cnt == SPARE_PAGES)
+	{
+		app_log_error("No spare flash slot left for image page %lu", i);
+		return false;
+	}
+	app_log_warn("Retiring flash slot 0x%lx", image_page(i));
+	DISK_TRACE_EVENT(PAGE_RETIRED, image_page(i), 0);
+	DISK_STATS_ADD(retired_pages, 1);
+	page_map[i] = IMAGE_PAGES + remap_cnt++;
+	if (remap_program(remap_cnt - 1) != HAL_OK)
+	{
+		app_log_error("Unable to program the remap table", NULL);
+	}
+	return true;
+}
+
+// Erase the sector, program the remap table and the image, DISK_VERIFY_RETRIES more times
+// if the image does not read back. The rest of the sector is then still erased: move the
+// image to the next spare slot while there is one.
+static HAL_StatusTypeDef image_write_sector(void)
+{
+	for (u32 attempt = 0; attempt <= DISK_VERIFY_RETRIES; attempt++)
+	{
+		HAL_StatusTypeDef status = region_erase();
+		for (u32 n = 0; n < remap_cnt && status == HAL_OK; n++)
+		{
+			status = remap_program(n);
+		}
+		if (status == HAL_OK && image_program(0))
+		{
+			return HAL_OK;
+		}
+	}
+	while (remap_retire(0))
+	{
+		if (image_program(0))
+		{
+			return HAL_OK;
+		}
+	}
+	return HAL_ERROR;
+}
+#endif
+#endif
+
+// Commits refuse to erase a region that is not made of whole erase units
+static bool region_writable(void)
+{
+	if (region_misaligned)
+	{
+		app_log_error("User data region is not made of whole erase units: not programming it", NULL);
+	}
+	return !region_misaligned;
+}
+
+u8 rewrite_dirty_flash_pages(void)
+{
+	if (!region_writable())
+	{
+		return HAL_ERROR;
+	}
+#if DISK_STORE_TLV
+	memset(page_dirty_mask, 0, sizeof(page_dirty_mask));
+	u8 status = tlv_commit(false);
+	// A record that did not read back ends the log: the retry compacts past it
+	for (u32 attempt = 0; status != HAL_OK && attempt < DISK_VERIFY_RETRIES; attempt++)
+	{
+		status = tlv_commit(false);
+	}
+	return status;
+#elif DISK_STORE_LOG
+	// The dry run in store_commit() finds out whether anything changed
+	memset(page_dirty_mask, 0, sizeof(page_dirty_mask));
+	u8 status = store_commit(false);
+	// A record that did not read back is left behind: the retry goes after it
+	for (u32 attempt = 0; status != HAL_OK && attempt < DISK_VERIFY_RETRIES; attempt++)
+	{
+		status = store_commit(false);
+	}
+	return status;
+#else
+	u32 i;
+	HAL_StatusTypeDef status;
+
+	status = HAL_FLASH_Unlock();
+	if (status != HAL_OK)
+	{
+		app_log_error("Unable to unlock flash: %d", status);
+	}
+
+#if !DISK_FLASH_SECTORS
+	// F1/L4/G0: Multiple 1KB/2KB pages - rewrite every page whose RAM copy differs from flash.
+	// The dirty mask alone is not enough: validate_file() rewrites all of FILE_SECTOR.
+	for (i = 0; i < IMAGE_PAGES; i++)
+	{
+		page_dirty_mask[i] = 0;
+		if (!buffers_differ(&disk_buffer[i * FLASH_PAGE_SIZE], (u8 *)image_page(i), image_page_len(i)))
+		{
+			continue;
+		}
+		if (image_write_page(i) != HAL_OK)
+		{
+			status = HAL_ERROR;
+		}
+	}
+	if (map_active && status == HAL_OK)
+	{
+		map_level();
+	}
+#else
+	// F4: The image shares one erase with its sector - check if any page is dirty
+	for (i = 0; i < sizeof(page_dirty_mask); i++)
+	{
+		if (page_dirty_mask[i])
+		{
+			memset(page_dirty_mask, 0, sizeof(page_dirty_mask));
+			// A save that normalizes back to the flash content costs a 1s erase for nothing
+			if (!buffers_differ(disk_buffer, (u8 *)image_page(0), sizeof(disk_buffer)))
+			{
+				break;
+			}
+			// Erase the entire sector and rewrite all data
+			status = image_write_sector();
+			break;
+		}
+	}
+#endif
+
+	if (HAL_FLASH_Lock() != HAL_OK)
+	{
+		app_log_error("Unable to lock flash", NULL);
+	}
+	return status;
+#endif
+}
+
+u8 rewrite_all_flash_pages(void)
+{
+	if (!region_writable())
+	{
+		return HAL_ERROR;
+	}
+#if DISK_STORE_TLV
+	return tlv_commit(true);
+#elif DISK_STORE_LOG
+	return store_commit(true);
+#else
+	u8 result = HAL_OK;
+	HAL_StatusTypeDef status;
+
+	status = HAL_FLASH_Unlock();
+	if (status != HAL_OK)
+	{
+		app_log_error("Unable to unlock flash: %d", status);
+	}
+
+#if !DISK_FLASH_SECTORS
+	// F1/L4/G0: Erase and program every page
+	for (u16 i = 0; i < IMAGE_PAGES && result == HAL_OK; i++)
+	{
+		result = image_write_page(i);
+	}
+#else
+	// F4: Erase the sector
+	result = image_write_sector();
+#endif
+
+	if (HAL_FLASH_Lock() != HAL_OK)
+	{
+		app_log_error("Unable to lock flash", NULL);
+	}
+	return result;
+#endif
+}
+
+// Looks up an 8.3 name (upper case) in the first root directory sector.
+// Returns the directory slot with its first cluster and size, or -1.
+static int dir_find(const u8 *name, u16 *cluster, u32 *size)
+{
+	u8 upper[11];
+	for (int n = 0; n < DIR_SLOT_CNT; n++)
+	{
+#if DISK_META_SYNTH
+		const disk_file_t *f = &files[n];
+		memcpy(upper, f->name, 11);
+		Upper(upper, 11);
+		if (f->name[0] != 0x00 && memcmp(upper, name, 11) == 0)
+		{
+			*cluster = f->cluster;
+			*size = f->size;
+			return n;
+		}
+#else
+		const u8 *entry = ROOT_SECTOR + n * 32;
+		memcpy(upper, entry, 11);
+		Upper(upper, 11);
+		if (memcmp(upper, name, 11) == 0)
+		{
+			*cluster = entry[0x1A] | (entry[0x1B] << 8);
+			*size = entry[0x1C] | (entry[0x1D] << 8) | (entry[0x1E] << 16) | ((u32)entry[0x1F] << 24);
+			return n;
+		}
+#endif
+	}
+	return -1;
+}
+
+// Helper to get CONFIG.TXT's starting cluster from directory entry
+static u16 get_config_start_cluster(void)
+{
+	u16 cluster;
+	u32 size;
+	return dir_find(CONFIG_FILENAME, &cluster, &size) >= 0 ? cluster : 0; // 0: not found
+}
+
+// Helper to find comment start in a value (tab followed by #)
+static u8 *find_comment_start(u8 *value)
+{
+	u32 len = strlen((char *)value);
+	u32 i = 0;
+	while ((i += swar_find_byte(value + i, len - i, '\t')) < len)
+	{
+		if (value[i + 1] == '#')
+			return value + i;
+		i++;
+	}
+	return NULL;
+}
+
+#if !DISK_META_SYNTH
+// Helper to set a FAT12 entry value
+// FAT12 entries are 12 bits each, packed as: [low8_0][high4_0|low4_1][high8_1]
+static void set_fat12_entry(u8 *fat, u16 cluster, u16 value)
+{
+	u32 offset = cluster + (cluster / 2); // 1.5 bytes per entry
+	if (cluster & 1)
+	{
+		// Odd cluster: high nibble of byte[offset], full byte[offset+1]
+		fat[offset] = (fat[offset] & 0x0F) | ((value & 0x0F) << 4);
+		fat[offset + 1] = (value >> 4) & 0xFF;
+	}
+	else
+	{
+		// Even cluster: full byte[offset], low nibble of byte[offset+1]
+		fat[offset] = value & 0xFF;
+		fat[offset + 1] = (fat[offset + 1] & 0xF0) | ((value >> 8) & 0x0F);
+	}
+}
+#endif
+
+#if DISK_META_SYNTH || DISK_STATS
+// Writes FAT12 entry cluster into fat_sector (0-11) as read by the host. Same packing as
+// set_fat12_entry, but the entry may straddle two sectors.
+static void fat_put(u8 *pbuffer, u32 fat_sector, u16 cluster, u16 value)
+{
+	u32 base = fat_sector * SECTOR_SIZE;
+	u32 offset = cluster + (cluster / 2);
+	u8 bits[2], mask[2];
+	if (cluster & 1)
+	{
+		bits[0] = (value & 0x0F) << 4, mask[0] = 0xF0;
+		bits[1] = value >> 4, mask[1] = 0xFF;
+	}
+	else
+	{
+		bits[0] = value & 0xFF, mask[0] = 0xFF;
+		bits[1] = (value >> 8) & 0x0F, mask[1] = 0x0F;
+	}
+	for (u32 k = 0; k < 2; k++)
+	{
+		if (offset + k >= base && offset + k < base + SECTOR_SIZE)
+		{
+			pbuffer[offset + k - base] = (pbuffer[offset + k - base] & ~mask[k]) | bits[k];
+		}
+	}
+}
+#endif
+
+#if DISK_META_SYNTH
+#define CLUSTER_CNT SECTOR_TO_CLUSTER(SECTOR_CNT) // clusters 2 .. CLUSTER_CNT-1 hold data
+
+// Clusters a file's chain spans. Files are taken to be contiguous, as validate_file()
+// reads them; a directory (size 0) gets one cluster.
+static u32 file_clusters(const disk_file_t *f)
+{
+	if (f->name[0] == 0x00 || f->cluster < 2 || f->cluster >= CLUSTER_CNT)
+	{
+		return 0;
+	}
+	u32 n = MAX((f->size + SECTOR_SIZE - 1) / SECTOR_SIZE, 1);
+	return MIN(n, CLUSTER_CNT - f->cluster);
+}
+
+// FAT sector fat_sector (0-11), FAT1 and FAT2 alike: one chain of consecutive clusters
+// per file, from its first cluster and size
+static void synth_fat_sector(u8 *pbuffer, u32 fat_sector)
+{
+	// Clusters whose 12-bit entry touches this sector
+	u32 lo = fat_sector * SECTOR_SIZE * 2 / 3;
+	u32 hi = ((fat_sector + 1) * SECTOR_SIZE * 2 + 2) / 3;
+
+	memset(pbuffer, 0, SECTOR_SIZE);
+	if (fat_sector == 0)
+	{
+		memcpy(pbuffer, fat_data, 3); // media descriptor, cluster 1 reserved
+	}
+	for (u32 n = 0; n < DIR_SLOT_CNT; n++)
+	{
+		u32 first = files[n].cluster, end = first + file_clusters(&files[n]);
+		for (u32 c = MAX(first, lo); c < MIN(end, hi); c++)
+		{
+			fat_put(pbuffer, fat_sector, c, c + 1 < end ? c + 1 : 0xFFF);
+		}
+	}
+}
+
+// Root directory sector 0 from files[]. Free slots read as deleted entries up to the
+// last used one, so the directory does not end early.
+static void synth_dir_sector(u8 *pbuffer)
+{
+	u32 used = 0;
+
+	memset(pbuffer, 0, SECTOR_SIZE);
+	for (u32 n = 0; n < DIR_SLOT_CNT; n++)
+	{
+		if (files[n].name[0] != 0x00)
+		{
+			used = n + 1;
+		}
+	}
+	for (u32 n = 0; n < used; n++)
+	{
+		const disk_file_t *f = &files[n];
+		u8 *entry = pbuffer + n * 32;
+		if (f->name[0] == 0x00)
+		{
+			entry[0] = 0xE5;
+			continue;
+		}
+		memcpy(entry, f->name, 11);
+		entry[0x0B] = f->attr;
+		memcpy(entry + 0x16, &f->time, 2);
+		memcpy(entry + 0x18, &f->date, 2);
+		memcpy(entry + 0x1A, &f->cluster, 2);
+		memcpy(entry + 0x1C, &f->size, 4);
+	}
+}
+
+// Host write of root directory sector 0: keep name, attributes, write time, first cluster
+// and size of each entry. Long name and deleted entries are dropped.
+static void synth_parse_dir(const u8 *sector)
+{
+	bool end = false;
+
+	for (u32 n = 0; n < DIR_SLOT_CNT; n++)
+	{
+		const u8 *entry = sector + n * 32;
+		disk_file_t *f = &files[n];
+		end = end || entry[0] == 0x00;
+		if (end || entry[0] == 0xE5 || entry[0x0B] == 0x0F)
+		{
+			memset(f, 0, sizeof(*f));
+			continue;
+		}
+		memcpy(f->name, entry, 11);
+		f->attr = entry[0x0B];
+		memcpy(&f->time, entry + 0x16, 2);
+		memcpy(&f->date, entry + 0x18, 2);
+		memcpy(&f->cluster, entry + 0x1A, 2);
+		memcpy(&f->size, entry + 0x1C, 4);
+		if (memcmp(f->name, CONFIG_FILENAME, 11) == 0)
+		{
+			DISK_TRACE_EVENT(WRITE_DIR_CONFIG, f->cluster, f->size);
+		}
+	}
+}
+
+// Slot 0 holds CONFIG.TXT at cluster 2, all other slots are free
+static void synth_config_only(u32 size)
+{
+	memset(files, 0, sizeof(files));
+	memcpy(files[0].name, CONFIG_FILENAME, 11);
+	files[0].time = VOLUME & 0xFFFF;
+	files[0].date = VOLUME >> 16;
+	files[0].cluster = 2;
+	files[0].size = size;
+}
+#else
+// Update FAT chain for CONFIG.TXT based on file size
+static void update_fat_chain(u32 file_size)
+{
+	u32 clusters_needed = (file_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	if (clusters_needed == 0)
+		clusters_needed = 1;
+
+	// Reset FAT (keep clusters 0 and 1 as reserved)
+	memset(FAT1_SECTOR + 3, 0, SECTOR_SIZE - 3);
+
+	// Chain clusters starting from 2
+	for (u32 i = 0; i < clusters_needed; i++)
+	{
+		u16 cluster = 2 + i;
+		u16 next = (i == clusters_needed - 1) ? 0xFFF : (cluster + 1); // EOF or next
+		set_fat12_entry(FAT1_SECTOR, cluster, next);
+	}
+
+	// Copy to FAT2
+	memcpy(FAT2_SECTOR, FAT1_SECTOR, SECTOR_SIZE);
+}
+#endif
+
+// Static buffer for extracted values (to avoid modifying parse_buffer during extraction)
+static u8 value_buffer[FILE_ROW_CNT];
+
+#if DISK_CALLBACK_BUDGET_US
+// Application callbacks, timed per entry against its budget (DISK_CALLBACK_BUDGET_US)
+static const char *const callback_names[DISK_CALLBACK_KINDS] = {"validate", "update", "print"};
+static struct
+{
+	u32 budget_us[FILE_ENTRY_CNT];
+	u32 max_us[FILE_ENTRY_CNT][DISK_CALLBACK_KINDS];
+	u32 overruns[FILE_ENTRY_CNT];
+} callback;
+
+static void callback_done(u32 k, u32 kind, u32 ticks)
+{
+	u32 us = ticks / DiskProf.ticks_per_us();
+
+	callback.max_us[k][kind] = MAX(callback.max_us[k][kind], us);
+	if (callback.budget_us[k] && us > callback.budget_us[k])
+	{
+		callback.overruns[k]++;
+		DISK_TRACE_EVENT(CALLBACK_OVERRUN, k, us);
+		app_log_warn("%s %s callback took %lu us, budget %lu us", entries[k].entry, callback_names[kind],
+					 (unsigned long)us, (unsigned long)callback.budget_us[k]);
+	}
+}
+
+#define CALLBACK_BEGIN() const u32 callback_t0 = disk_prof_now()
+#define CALLBACK_END(k, kind) callback_done(k, kind, disk_prof_now() - callback_t0)
+#else
+#define CALLBACK_BEGIN() ((void)0)
+#define CALLBACK_END(k, kind) ((void)0)
+#endif
+
+static bool call_validate(u32 k, u8 *value)
+{
+	CALLBACK_BEGIN();
+	bool valid = entries[k].validate(value);
+	CALLBACK_END(k, DISK_CALLBACK_VALIDATE);
+	return valid;
+}
+
+static void call_update(u32 k, u8 *value)
+{
+	CALLBACK_BEGIN();
+	entries[k].update(value);
+	CALLBACK_END(k, DISK_CALLBACK_UPDATE);
+}
+
+static void call_print(u32 k, char *buffer, size_t buffer_size)
+{
+	CALLBACK_BEGIN();
+	entries[k].print(buffer, buffer_size);
+	CALLBACK_END(k, DISK_CALLBACK_PRINT);
+}
+
+#if DISK_UPDATE_STEPS
+// Updates run from process() (DISK_UPDATE_STEPS). An entry is queued when its value differs
+// from the one its updater last received, by CRC; its line in parse_buffer[k] keeps the
+// value as written until the update ran.
+static struct
+{
+	u32 pending; // entry bits, the lowest runs first
+	u32 known;   // entries whose updater received a value since init()
+	u32 crc[FILE_ENTRY_CNT];
+	bool reprint; // a printer rendered its value differently from the line in CONFIG.TXT
+} updates;
+
+// Queue entry k's update with value, unless the entry has no updater, value is NULL or it
+// is the value the updater last received. Returns true if queued.
+static bool update_queue(u32 k, const u8 *value)
+{
+	u32 bit = 1UL << k;
+
+	updates.pending &= ~bit;
+	if (entries[k].update == NULL || value == NULL)
+	{
+		return false;
+	}
+	u32 crc = DiskStore.crc32(0, value, strlen((const char *)value));
+	if ((updates.known & bit) && updates.crc[k] == crc)
+	{
+		return false;
+	}
+	updates.pending |= bit;
+	return true;
+}
+
+// Run the first queued update with the value from its "ENTRY=value" line, then its printer
+static void update_next(void)
+{
+	u32 k = __builtin_ctz(updates.pending);
+	const char *value = (const char *)parse_buffer[k] + strlen(entries[k].entry) + 1;
+
+	updates.pending &= ~(1UL << k);
+	memset(value_buffer, 0, sizeof(value_buffer));
+	memcpy(value_buffer, value, MIN(strlen(value), FILE_ROW_CNT - 1));
+	call_update(k, value_buffer);
+	updates.crc[k] = DiskStore.crc32(0, value_buffer, strlen((char *)value_buffer));
+	updates.known |= 1UL << k;
+	DISK_STATS_ADD(stepped_updates, 1);
+	if (entries[k].print)
+	{
+		call_print(k, (char *)file_buffer, FILE_ROW_CNT);
+		updates.reprint |= strcmp((char *)file_buffer, (char *)parse_buffer[k]) != 0;
+	}
+}
+
+// One process() step: queued updates, at least one, until DISK_UPDATE_SLICE_US is spent.
+// A printed line that differs from the file gets a commit, whose validation renders it.
+static void update_step(void)
+{
+	u32 t0 = disk_prof_now();
+	u32 slice = DISK_UPDATE_SLICE_US * DiskProf.ticks_per_us();
+
+	DISK_STATS_ADD(update_steps, 1);
+	do
+	{
+		update_next();
+	} while (updates.pending && disk_prof_now() - t0 < slice);
+	if (!updates.pending && updates.reprint)
+	{
+		updates.reprint = false;
+		if (!pending_flash_write)
+		{
+			defer_flash_write();
+		}
+	}
+}
+#endif
+
+static bool value_valid(u32 k)
+{
+	return entries[k].validate == NULL || call_validate(k, value_buffer);
+}
+
+// Hand value_buffer to the application for entry k if valid, leaving the clean
+// "ENTRY=value" line in parse_buffer[k]. Returns 1 if the default had to be used.
+static u8 apply_checked(u32 k, bool valid)
+{
+	if (valid)
+	{
+#if DISK_UPDATE_STEPS
+		bool queued = update_queue(k, value_buffer); // printed once process() ran the update
+#else
+		bool queued = false;
+		if (entries[k].update)
+			call_update(k, value_buffer);
+#endif
+		// Printer writes clean ENTRY=value to parse_buffer[k]
+		if (entries[k].print && !queued)
+			call_print(k, (char *)parse_buffer[k], FILE_ROW_CNT);
+		else
+			snprintf((char *)parse_buffer[k], FILE_ROW_CNT, "%s=%.*s", entries[k].entry,
+					 (int)(FILE_ROW_CNT - MAX_ENTRY_LABEL_LENGTH - 1), value_buffer);
+		return 0;
+	}
+#if DISK_UPDATE_STEPS
+	update_queue(k, NULL);
+#endif
+	// Validation failed, use default
+	snprintf((char *)parse_buffer[k], FILE_ROW_CNT, "%s=%s",
+			 entries[k].entry, entries[k].default_value ? entries[k].default_value : "");
+	return 1;
+}
+
+// Validate value_buffer for entry k and apply it, see apply_checked()
+static u8 apply_value(u32 k)
+{
+	return apply_checked(k, value_valid(k));
+}
+
+#if DISK_VALIDATE_AHEAD
+// Validation ahead of the commit. write_sector() notes the data sectors of a CONFIG.TXT
+// stream as they land, and process() splits them into lines and runs the validators while
+// the host is still saving. A line may span sectors: its start is kept until its end lands.
+// validate_file() then only copies the lines and applies the values, provided it reads the
+// file from where the stream starts and the stream reached the end of the content.
+#define PIPE_IDLE 0xFFFFFFFFUL
+static struct
+{
+	u32 start;  // FILE_SECTOR offset of the stream, PIPE_IDLE = none (set by write_sector())
+	u32 landed; // bytes the host wrote from start on (set by write_sector())
+	u32 gen;    // bumped by write_sector() for every new or dropped stream
+	bool host;  // the stream is host data, not render_file() output
+	u32 seen;   // gen the state below belongs to
+	u32 limit;  // bytes validate_file() reads from start
+	u32 pos;    // start of the line being scanned
+	u32 scan;   // bytes from pos already searched for its end
+	u32 lines;  // complete lines
+	bool done;  // the content ended, or FILE_ENTRY_CNT lines
+	u16 line_pos[FILE_ENTRY_CNT];
+	u16 line_len[FILE_ENTRY_CNT];  // without the line ending, before truncation to FILE_ROW_CNT
+	u8 entry_line[FILE_ENTRY_CNT]; // line + 1 entry k was first found on, 0 = not found yet
+	bool valid[FILE_ENTRY_CNT];    // validate() verdict of that line's value
+} pipe = {.start = PIPE_IDLE};
+
+static void pipe_reset(void)
+{
+	pipe.start = PIPE_IDLE;
+	pipe.gen++;
+}
+
+// render_file() rewrote FILE_SECTOR: validate it in idle time, so a commit without new
+// file data from the host (directory and FAT writes only) finds it done
+static void pipe_rendered(void)
+{
+	pipe.start = 0;
+	pipe.landed = FILE_SECTOR_SIZE;
+	pipe.host = false;
+	pipe.gen++;
+}
+
+#endif
+
+// Rebuild CONFIG.TXT from the parse_buffer lines (in registration order) into
+// FILE_SECTOR at cluster 2, with its size in directory slot root_addr and its FAT chain
+static u32 render_file(u16 root_addr)
+{
+	u32 k, m;
+
+	memset(file_content_buffer, 0x00, FILE_CHAR_CNT);
+	m = 0;
+	for (k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		// Skip unregistered entries
+		if (entries[k].entry[0] == '\0')
+			continue;
+
+		size_t line_len = strlen((char *)parse_buffer[k]);
+		size_t comment_len = strlen((char *)entries[k].comment);
+
+		if (m + line_len + comment_len < FILE_CHAR_CNT - 1)
+		{
+			memcpy(file_content_buffer + m, parse_buffer[k], line_len);
+			m += line_len;
+			memcpy(file_content_buffer + m, entries[k].comment, comment_len);
+			m += comment_len;
+		}
+	}
+
+#if DISK_META_SYNTH
+	// The rest of the buffered data area is cleared below: other files stored there are gone
+	for (k = 0; k < DIR_SLOT_CNT; k++)
+	{
+		if (k != root_addr && files[k].cluster < 2 + FILE_SECTOR_SIZE / SECTOR_SIZE &&
+			files[k].cluster + file_clusters(&files[k]) > 2)
+		{
+			memset(&files[k], 0, sizeof(files[k]));
+		}
+	}
+	files[root_addr].cluster = 2;
+	files[root_addr].size = m;
+	page_dirty_mask[0] = 1;
+#else
+	u8 *dir_entry = ROOT_SECTOR + root_addr * 32;
+
+	// Update file size in directory entry (support sizes > 255 bytes)
+	dir_entry[0x1C] = m & 0xFF;
+	dir_entry[0x1D] = (m >> 8) & 0xFF;
+	dir_entry[0x1E] = (m >> 16) & 0xFF;
+	dir_entry[0x1F] = (m >> 24) & 0xFF;
+
+	// ALWAYS force file to start at cluster 2 for consistency
+	// macOS may allocate different clusters, but we normalize to cluster 2
+	// This ensures directory entry, FAT chain, and data location are all aligned
+	dir_entry[0x1A] = 0x02; // Starting cluster low byte
+	dir_entry[0x1B] = 0x00; // Starting cluster high byte
+
+	// Update FAT chain for the new file size (always starts at cluster 2)
+	update_fat_chain(m);
+
+	// Mark pages dirty (FAT and directory)
+	page_dirty_mask[0] = 1; // FAT was updated
+	page_dirty_mask[1] = 1; // Root directory
+#endif
+
+	// ALWAYS write content to FILE_SECTOR (cluster 2 = sector 64)
+	// regardless of where macOS wrote it, to match our FAT chain
+	memcpy(FILE_SECTOR, file_content_buffer, m);
+	// Clear remaining space to avoid stale data
+	if (m < FILE_SECTOR_SIZE)
+	{
+		memset(FILE_SECTOR + m, 0, FILE_SECTOR_SIZE - m);
 	}
-	return 0;
+#if DISK_VALIDATE_AHEAD
+	pipe_rendered();
+#endif
+	return m;
 }
 
-u8 rewrite_all_flash_pages(void)
+// Fresh volume holding only CONFIG.TXT, built from the parse_buffer lines
+static u32 create_image(void)
 {
-	u16 i;
-	u8 result;
-	u16 *f_buff = (u16 *)disk_buffer;
-	HAL_StatusTypeDef status;
-
-	status = HAL_FLASH_Unlock();
-	if (status != HAL_OK)
-	{
-		app_log_error("Unable to unlock flash: %d", status);
-	}
+	memset(disk_buffer, 0x00, sizeof(disk_buffer));
+#if DISK_META_SYNTH
+	synth_config_only(0);
+#else
+	memcpy(ROOT_SECTOR, &CONFIG_FILENAME, 0xC);
+	memcpy(FAT1_SECTOR, fat_data, 6);
+	memcpy(FAT2_SECTOR, fat_data, 6);
+	disk_buffer[0x40B] = 0x0; // attributes
+	*(u32 *)VOLUME_BASE = VOLUME;
+#endif
+	u32 m = render_file(0);
+	memset(page_dirty_mask, 1, sizeof(page_dirty_mask)); // Mark all pages dirty
+	return m;
+}
 
-#if defined(STM32F103xB)
-	// F1: Erase multiple 1KB pages
-	for (i = 0; i < 8; i++)
-	{
-		result = erase_flash_page(APP_BASE + i * FLASH_PAGE_SIZE);
-		if (result != HAL_OK)
-		{
-			return result;
-		}
-	}
-	for (i = 0; i < (SECTOR_CNT / 2); i += 2)
+// A registered "ENTRY=" at p: the start of CONFIG.TXT content
+static bool starts_with_entry(const u8 *p)
+{
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
 	{
-		result = write_flash_halfword((u32)(APP_BASE + i), *f_buff++);
-		if (result != HAL_OK)
+		size_t entry_len = strlen(entries[k].entry);
+		if (entry_len && memcmp(p, entries[k].entry, entry_len) == 0 && p[entry_len] == '=')
 		{
-			app_log_error("Error while programming flash at %d", i);
-			return result;
+			return true;
 		}
 	}
-#elif defined(STM32F411xE)
-	// F4: Erase single 16KB sector
-	result = erase_flash_page(APP_BASE);
-	if (result != HAL_OK)
+	return false;
+}
+
+#if DISK_VALIDATE_AHEAD
+// write_sector(): the host wrote the data sector at FILE_SECTOR offset. Cheap, it may
+// run in the USB interrupt.
+static void pipe_landed(u32 offset, const u8 *data)
+{
+	if (pipe.start != PIPE_IDLE && offset == pipe.start + pipe.landed)
 	{
-		return result;
+		pipe.landed += SECTOR_SIZE;
 	}
-	// Write the entire buffer
-	for (i = 0; i < sizeof(disk_buffer); i += 2)
+	else if (starts_with_entry(data))
 	{
-		result = write_flash_halfword((u32)(APP_BASE + i), *f_buff++);
-		if (result != HAL_OK)
-		{
-			app_log_error("Error while programming flash at %d", i);
-			return result;
-		}
+		// A file starts here, or the stream's file is being rewritten from its start
+		pipe.start = offset;
+		pipe.landed = SECTOR_SIZE;
+		pipe.host = true;
+		pipe.gen++;
 	}
-#endif
-
-	if (HAL_FLASH_Lock() != HAL_OK)
+	else if (pipe.start != PIPE_IDLE && offset >= pipe.start && offset < pipe.start + pipe.landed)
 	{
-		app_log_error("Unable to lock flash", NULL);
+		// Data already parsed changed
+		pipe.start = PIPE_IDLE;
+		pipe.gen++;
 	}
-	return HAL_OK;
 }
 
-// Helper to get CONFIG.TXT's starting cluster from directory entry
-static u16 get_config_start_cluster(void)
+// validate_file()'s value extraction and validate() for line n of the stream
+static void pipe_check_line(const u8 *line, u32 len, u32 n)
 {
-	u8 *entry = ROOT_SECTOR;
-	u8 name[12];
-	for (int i = 0; i < 16; i++)
+	len = MIN(len, FILE_ROW_CNT - 1);
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
 	{
-		memcpy(name, entry, 11);
-		name[11] = '\0';
-		Upper(name, 11);
-		if (memcmp(name, CONFIG_FILENAME, 11) == 0)
+		size_t entry_len = strlen(entries[k].entry);
+		if (entry_len == 0 || pipe.entry_line[k] || len <= entry_len ||
+			memcmp(line, entries[k].entry, entry_len) != 0 || line[entry_len] != '=')
 		{
-			return entry[0x1A] | (entry[0x1B] << 8);
+			continue;
+		}
+		memset(value_buffer, 0, sizeof(value_buffer));
+		memcpy(value_buffer, line + entry_len + 1, len - entry_len - 1);
+		u8 *comment_start = find_comment_start(value_buffer);
+		if (comment_start)
+		{
+			memset(comment_start, 0, value_buffer + sizeof(value_buffer) - comment_start);
 		}
-		entry += 32;
+		pipe.valid[k] = value_valid(k);
+		pipe.entry_line[k] = n + 1;
 	}
-	return 0; // Not found
 }
 
-// Helper to find comment start in a value (tab followed by #)
-static u8 *find_comment_start(u8 *value)
+// Parse and validate whatever landed since the last call
+static void pipe_advance(void)
 {
-	u8 *p = value;
-	while (*p)
+	u32 gen = pipe.gen;
+	u32 start = pipe.start;
+
+	if (start == PIPE_IDLE)
 	{
-		// Comment starts with tab+# or just # preceded by whitespace
-		if (*p == '\t' && *(p + 1) == '#')
-			return p;
-		p++;
+		return;
+	}
+	if (pipe.seen != gen)
+	{
+		pipe.seen = gen;
+		pipe.limit = MIN(sizeof(file_buffer), FILE_SECTOR_SIZE - start);
+		pipe.pos = pipe.scan = pipe.lines = 0;
+		pipe.done = false;
+		memset(pipe.entry_line, 0, sizeof(pipe.entry_line));
+	}
+	const u8 *base = FILE_SECTOR + start;
+	while (!pipe.done && pipe.gen == gen)
+	{
+		u32 avail = MIN(pipe.landed, pipe.limit);
+		u32 from = pipe.pos + pipe.scan;
+		u32 i = from + swar_find_either(base + from, avail - from, 0x0A, '\0');
+		if (i >= avail && avail < pipe.limit)
+		{
+			pipe.scan = avail - pipe.pos; // the line ends in a sector still to come
+			return;
+		}
+		u32 j = i;
+		if (i < pipe.limit && base[i] == 0x0A && j > pipe.pos && base[j - 1] == 0x0D)
+		{
+			j--;
+		}
+		pipe.line_pos[pipe.lines] = pipe.pos;
+		pipe.line_len[pipe.lines] = j - pipe.pos;
+		pipe_check_line(base + pipe.pos, j - pipe.pos, pipe.lines);
+		pipe.lines++;
+		pipe.pos = i + 1;
+		pipe.scan = 0;
+		pipe.done = i >= pipe.limit || base[i] == '\0' || pipe.lines == FILE_ENTRY_CNT;
 	}
-	return NULL;
 }
 
-// Helper to set a FAT12 entry value
-// FAT12 entries are 12 bits each, packed as: [low8_0][high4_0|low4_1][high8_1]
-static void set_fat12_entry(u8 *fat, u16 cluster, u16 value)
+#if STREAM_COMMIT
+// Worst case compressed size of one sector: a literal token per 128 bytes
+#define STAGE_SECTOR_MAX (SECTOR_SIZE + SECTOR_SIZE / 128)
+
+// Sector i of the stream is likely to survive render_file(): every line in it is complete
+// and already in rendered shape, the n-th entry with a valid value, its comment and CRLF
+static bool stage_ready(u32 i)
 {
-	u32 offset = cluster + (cluster / 2); // 1.5 bytes per entry
-	if (cluster & 1)
+	u32 end = (i + 1) * SECTOR_SIZE;
+
+	if (pipe.seen != pipe.gen || pipe.pos < end)
 	{
-		// Odd cluster: high nibble of byte[offset], full byte[offset+1]
-		fat[offset] = (fat[offset] & 0x0F) | ((value & 0x0F) << 4);
-		fat[offset + 1] = (value >> 4) & 0xFF;
+		return false;
 	}
-	else
+	for (u32 n = 0; n < pipe.lines && pipe.line_pos[n] < end; n++)
 	{
-		// Even cluster: full byte[offset], low nibble of byte[offset+1]
-		fat[offset] = value & 0xFF;
-		fat[offset + 1] = (fat[offset + 1] & 0xF0) | ((value >> 8) & 0x0F);
+		const u8 *line = FILE_SECTOR + pipe.line_pos[n];
+		u32 len = pipe.line_len[n];
+		u32 clen = strlen(entries[n].comment) - 2; // without its CRLF
+		if (pipe.entry_line[n] != n + 1 || !pipe.valid[n] || len < clen ||
+			memcmp(line + len - clen, entries[n].comment, clen) != 0 || line[len] != 0x0D)
+		{
+			return false;
+		}
 	}
+	return true;
 }
 
-// Update FAT chain for CONFIG.TXT based on file size
-static void update_fat_chain(u32 file_size)
+// Program the next sector of a CONFIG.TXT save at cluster 2 into the log once the host has
+// written the one after it and stage_ready() expects the commit to keep it. Sectors the host
+// rewrites are voided. Between two calls nothing else may compress: the next sector
+// continues the compressed stream.
+static void stage_step(void)
 {
-	u32 clusters_needed = (file_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
-	if (clusters_needed == 0)
-		clusters_needed = 1;
+	u32 gen = pipe.gen;
+	u32 i = stage.chunks;
 
-	// Reset FAT (keep clusters 0 and 1 as reserved)
-	memset(FAT1_SECTOR + 3, 0, SECTOR_SIZE - 3);
-
-	// Chain clusters starting from 2
-	for (u32 i = 0; i < clusters_needed; i++)
+	if (i && (stage.stale || stage.gen != gen))
 	{
-		u16 cluster = 2 + i;
-		u16 next = (i == clusters_needed - 1) ? 0xFFF : (cluster + 1); // EOF or next
-		set_fat12_entry(FAT1_SECTOR, cluster, next);
+		HAL_FLASH_Unlock();
+		store_void();
+		HAL_FLASH_Lock();
+		return;
+	}
+	if (!pending_flash_write || budget.holding || !pipe.host || pipe.start != 0 ||
+		pipe.landed < (i + 2) * SECTOR_SIZE || !stage_ready(i))
+	{
+		return;
+	}
+	uintptr_t at = i ? store_out.addr : APP_BASE + store_end;
+	u32 room = (i ? store_out.fill : STORE_HEADER) + STAGE_SECTOR_MAX;
+	if (at + room > APP_BASE + APP_SIZE || !swar_is_fill((const u8 *)at, room, 0xFF))
+	{
+		return; // the commit restarts the log
 	}
 
-	// Copy to FAT2
-	memcpy(FAT2_SECTOR, FAT1_SECTOR, SECTOR_SIZE);
+	if (i == 0)
+	{
+		store_begin(APP_BASE + store_end + STORE_HEADER);
+		store_out.status = HAL_OK;
+		stage.crc = 0;
+		stage.gen = gen;
+	}
+	HAL_FLASH_Unlock();
+	DISK_TRACE_EVENT(PROGRAM_BEGIN, SECTOR_SIZE, store_out.addr);
+	DISK_PROF_BEGIN(FLASH_PROGRAM);
+	stage.crc = DiskStore.crc32(stage.crc, FILE_SECTOR + i * SECTOR_SIZE, SECTOR_SIZE);
+	DiskStore.compress_more(FILE_SECTOR, i * SECTOR_SIZE, (i + 1) * SECTOR_SIZE, store_program);
+	DISK_PROF_END(FLASH_PROGRAM);
+	DISK_TRACE_EVENT(PROGRAM_END, 0, 0);
+	HAL_FLASH_Lock();
+	stage.chunks++;
+	// A host write during the compression bumps gen
+	stage.stale = store_out.status != HAL_OK || pipe.gen != gen;
 }
-
-// Static buffer for extracted values (to avoid modifying parse_buffer during extraction)
-static u8 value_buffer[FILE_ROW_CNT];
+#endif
+#endif
 
 u8 validate_file(u8 *p_file, u16 root_addr)
 {
@@ -363,7 +2492,8 @@ u8 validate_file(u8 *p_file, u16 root_addr)
 	u8 *comment_start;
 	size_t value_len;
 
-	app_log_trace("starting, root_addr=%d", root_addr);
+	DISK_PROF_BEGIN(VALIDATE_FILE);
+	DISK_TRACE_EVENT(VALIDATE_BEGIN, root_addr, 0);
 
 	// Use static buffers instead of stack allocation
 	memset(parse_buffer, 0x00, sizeof(parse_buffer));
@@ -376,138 +2506,117 @@ u8 validate_file(u8 *p_file, u16 root_addr)
 
 	// Check if FILE_SECTOR starts with a valid entry (previously normalized)
 	// Look for any registered entry name at the start
-	bool file_sector_valid = false;
-	for (k = 0; k < FILE_ENTRY_CNT && !file_sector_valid; k++)
-	{
-		if (entries[k].entry[0] != '\0')
-		{
-			size_t entry_len = strlen(entries[k].entry);
-			if (memcmp(FILE_SECTOR, entries[k].entry, entry_len) == 0 &&
-				FILE_SECTOR[entry_len] == '=')
-			{
-				file_sector_valid = true;
-			}
-		}
-	}
+	bool file_sector_valid = starts_with_entry(FILE_SECTOR);
 
 	// Also check p_file location for valid content
-	bool p_file_valid = false;
-	if (p_file != FILE_SECTOR)
-	{
-		for (k = 0; k < FILE_ENTRY_CNT && !p_file_valid; k++)
-		{
-			if (entries[k].entry[0] != '\0')
-			{
-				size_t entry_len = strlen(entries[k].entry);
-				if (memcmp(p_file, entries[k].entry, entry_len) == 0 &&
-					p_file[entry_len] == '=')
-				{
-					p_file_valid = true;
-				}
-			}
-		}
-	}
+	bool p_file_valid = p_file != FILE_SECTOR && starts_with_entry(p_file);
 
 	// Prefer p_file if it has valid content (fresh write from macOS)
 	// Otherwise use FILE_SECTOR if it has valid content (previously normalized)
 	if (p_file_valid)
 	{
 		read_source = p_file;
-		app_log_trace("reading from p_file (macOS location)");
+		DISK_TRACE_EVENT(VALIDATE_SOURCE, 0, 0); // p_file (macOS location)
 	}
 	else if (file_sector_valid)
 	{
 		read_source = FILE_SECTOR;
-		app_log_trace("reading from FILE_SECTOR (normalized)");
+		DISK_TRACE_EVENT(VALIDATE_SOURCE, 1, 0); // FILE_SECTOR (normalized)
 	}
 	else
 	{
 		// Neither RAM location has valid content - this can happen if macOS
 		// dot files corrupted our RAM buffer. Try to recover from flash.
 		app_log_warn("no valid content in RAM, reloading from flash");
+#if DISK_VALIDATE_AHEAD
+		pipe_reset();
+#endif
 
 		// Reload FILE_SECTOR from flash
-		u8 *flash_file_sector = (u8 *)APP_BASE + 0x600;  // FILE_SECTOR offset in flash
-		memcpy(FILE_SECTOR, flash_file_sector, FILE_SECTOR_SIZE);
+#if DISK_STORE_TLV
+		tlv_load_file();
+#elif DISK_STORE_LOG
+		store_load_file();
+#else
+		image_read(FILE_SECTOR, META_BYTES, FILE_SECTOR_SIZE);
+#endif
 
 		// Check again if FILE_SECTOR now has valid content
-		for (k = 0; k < FILE_ENTRY_CNT; k++)
+		if (starts_with_entry(FILE_SECTOR))
 		{
-			if (entries[k].entry[0] != '\0')
-			{
-				size_t entry_len = strlen(entries[k].entry);
-				if (memcmp(FILE_SECTOR, entries[k].entry, entry_len) == 0 &&
-					FILE_SECTOR[entry_len] == '=')
-				{
-					file_sector_valid = true;
-					read_source = FILE_SECTOR;
-					app_log_debug("recovered from flash");
-					break;
-				}
-			}
+			file_sector_valid = true;
+			read_source = FILE_SECTOR;
+			app_log_debug("recovered from flash");
+			DISK_TRACE_EVENT(VALIDATE_SOURCE, 2, 0);
 		}
 
 		if (!file_sector_valid)
 		{
 			// Flash also doesn't have valid content - use defaults
 			read_source = p_file;
-			app_log_trace("flash also invalid, using defaults");
+			DISK_TRACE_EVENT(VALIDATE_SOURCE, 3, 0); // flash also invalid, defaults
 		}
 	}
 
-	memcpy((u8 *)file_buffer, read_source, sizeof(file_buffer));
-
-	// Log first 64 bytes of file content for debugging
-	app_log_trace("first bytes: %.60s", file_buffer);
-
-	// Parse each line from the file into parse_buffer
-	// Handle both CRLF (Windows) and LF (Unix/macOS) line endings
-	m = 0;
-	for (line_idx = 0; line_idx < FILE_ENTRY_CNT; line_idx++)
+#if DISK_VALIDATE_AHEAD
+	// Lines split and values validated while the host was saving
+	pipe_advance();
+	bool ahead = pipe.start != PIPE_IDLE && pipe.seen == pipe.gen && pipe.done &&
+				 FILE_SECTOR + pipe.start == read_source;
+	DISK_STATS_ADD(validated_ahead, ahead);
+	for (line_idx = 0; ahead && line_idx < pipe.lines; line_idx++)
+	{
+		j = MIN(pipe.line_len[line_idx], FILE_ROW_CNT - 1);
+		memcpy(parse_buffer[line_idx], read_source + pipe.line_pos[line_idx], j);
+		parse_buffer[line_idx][j] = '\0';
+	}
+	if (!ahead)
+#endif
 	{
-		j = 0;
-		u8 line_ending_len = 1; // Default for LF
-		for (i = m; i < sizeof(file_buffer) && file_buffer[i] != '\0'; i++)
+		// A file macOS placed in a high cluster ends with disk_buffer, not a file_buffer later
+		size_t available = disk_buffer + sizeof(disk_buffer) - read_source;
+		memcpy((u8 *)file_buffer, read_source, MIN(sizeof(file_buffer), available));
+		if (available < sizeof(file_buffer))
+		{
+			memset(file_buffer + available, 0, sizeof(file_buffer) - available);
+		}
+
+		// Parse each line from the file into parse_buffer
+		// Handle both CRLF (Windows) and LF (Unix/macOS) line endings
+		m = 0;
+		for (line_idx = 0; line_idx < FILE_ENTRY_CNT; line_idx++)
 		{
-			// Check for CRLF (Windows) or LF (Unix/macOS)
-			if (file_buffer[i] == 0x0D && file_buffer[i + 1] == 0x0A)
+			// The line ends at LF or at the end of the content; a CR right before the LF
+			// (Windows) is part of the line ending, a lone CR is kept
+			i = m + swar_find_either(file_buffer + m, sizeof(file_buffer) - m, 0x0A, '\0');
+			j = i;
+			if (i < sizeof(file_buffer) && file_buffer[i] == 0x0A && j > m && file_buffer[j - 1] == 0x0D)
 			{
-				line_ending_len = 2; // CRLF
-				break;
+				j--;
 			}
-			else if (file_buffer[i] == 0x0A)
-			{
-				line_ending_len = 1; // LF only
+			j = MIN(j - m, FILE_ROW_CNT - 1);
+			swar_copy(parse_buffer[line_idx], file_buffer + m, j);
+			parse_buffer[line_idx][j] = '\0';
+			m = i + 1;
+
+			// Stop if we've reached end of file content
+			if (i >= sizeof(file_buffer) || file_buffer[i] == '\0')
 				break;
-			}
-			else
-			{
-				if (j < FILE_ROW_CNT - 1)
-				{
-					parse_buffer[line_idx][j++] = file_buffer[i];
-				}
-				m++;
-			}
 		}
-		parse_buffer[line_idx][j] = '\0';
-		m = i + line_ending_len;
-
-		// Stop if we've reached end of file content
-		if (i >= sizeof(file_buffer) || file_buffer[i] == '\0')
-			break;
 	}
 
-	// Debug: log how many lines were parsed
+#if DISK_TRACE
 	u32 parsed_count = 0;
 	for (u32 idx = 0; idx < FILE_ENTRY_CNT; idx++)
 	{
 		if (parse_buffer[idx][0] != '\0')
 		{
 			parsed_count++;
-			app_log_trace("line %lu: %.40s...", idx, parse_buffer[idx]);
+			DISK_TRACE_EVENT(VALIDATE_LINE, idx, strlen((char *)parse_buffer[idx]));
 		}
 	}
-	app_log_trace("parsed %lu lines", parsed_count);
+	DISK_TRACE_EVENT(VALIDATE_PARSED, parsed_count, 0);
+#endif
 
 	// Process each registered entry - search for it in parsed lines
 	for (k = 0; k < FILE_ENTRY_CNT; k++)
@@ -548,21 +2657,12 @@ u8 validate_file(u8 *p_file, u16 root_addr)
 				memcpy(value_buffer, value_start, MIN(value_len, FILE_ROW_CNT - 1));
 
 				// Validate and update with clean value (no comment)
-				if (entries[k].validate == NULL || entries[k].validate(value_buffer))
-				{
-					if (entries[k].update)
-						entries[k].update(value_buffer);
-					// Printer writes clean ENTRY=value to parse_buffer[k]
-					if (entries[k].print)
-						entries[k].print((char *)parse_buffer[k], FILE_ROW_CNT);
-				}
+#if DISK_VALIDATE_AHEAD
+				if (ahead && pipe.entry_line[k] == line_idx + 1)
+					illegal |= apply_checked(k, pipe.valid[k]);
 				else
-				{
-					// Validation failed, use default
-					snprintf((char *)parse_buffer[k], FILE_ROW_CNT, "%s=%s",
-							 entries[k].entry, entries[k].default_value ? entries[k].default_value : "");
-					illegal = 1;
-				}
+#endif
+					illegal |= apply_value(k);
 				break;
 			}
 		}
@@ -577,101 +2677,52 @@ u8 validate_file(u8 *p_file, u16 root_addr)
 				entries[k].entry,
 				entries[k].default_value ? entries[k].default_value : "");
 
+#if DISK_UPDATE_STEPS
+			update_queue(k, (u8 *)entries[k].default_value);
+#else
 			if (entries[k].update && entries[k].default_value)
 			{
-				entries[k].update((u8 *)entries[k].default_value);
+				call_update(k, (u8 *)entries[k].default_value);
 			}
+#endif
 
 			illegal = 1;
 		}
 	}
 
 	// Rebuild file content from entries (in registration order)
-	memset(file_content_buffer, 0x00, FILE_CHAR_CNT);
-	m = 0;
-	for (k = 0; k < FILE_ENTRY_CNT; k++)
-	{
-		// Skip unregistered entries
-		if (entries[k].entry[0] == '\0')
-			continue;
-
-		size_t line_len = strlen((char *)parse_buffer[k]);
-		size_t comment_len = strlen((char *)entries[k].comment);
-
-		if (m + line_len + comment_len < FILE_CHAR_CNT - 1)
-		{
-			memcpy(file_content_buffer + m, parse_buffer[k], line_len);
-			m += line_len;
-			memcpy(file_content_buffer + m, entries[k].comment, comment_len);
-			m += comment_len;
-		}
-	}
-
-	app_log_trace("rebuilt file, size=%lu bytes", m);
-
-	// Update file size in directory entry (support sizes > 255 bytes)
-	// ROOT_SECTOR + root_addr*32 + 0x1C is where file size is stored
-	u8 *dir_entry = ROOT_SECTOR + (root_addr * 32);
-	dir_entry[0x1C] = m & 0xFF;
-	dir_entry[0x1D] = (m >> 8) & 0xFF;
-	dir_entry[0x1E] = (m >> 16) & 0xFF;
-	dir_entry[0x1F] = (m >> 24) & 0xFF;
-
-	// ALWAYS force file to start at cluster 2 for consistency
-	// macOS may allocate different clusters, but we normalize to cluster 2
-	// This ensures directory entry, FAT chain, and data location are all aligned
-	dir_entry[0x1A] = 0x02; // Starting cluster low byte
-	dir_entry[0x1B] = 0x00; // Starting cluster high byte
-
-	app_log_trace("forcing cluster=2, size=%lu", m);
-
-	// Update FAT chain for the new file size (always starts at cluster 2)
-	update_fat_chain(m);
-
-	// Mark pages dirty (FAT and directory)
-	page_dirty_mask[0] = 1; // FAT was updated
-	page_dirty_mask[1] = 1; // Root directory
-
-	// ALWAYS write content to FILE_SECTOR (cluster 2 = sector 64)
-	// regardless of where macOS wrote it, to match our FAT chain
-	memcpy(FILE_SECTOR, file_content_buffer, m);
-	// Clear remaining space to avoid stale data
-	if (m < FILE_SECTOR_SIZE)
-	{
-		memset(FILE_SECTOR + m, 0, FILE_SECTOR_SIZE - m);
-	}
+	m = render_file(root_addr);
 
+	DISK_TRACE_EVENT(VALIDATE_END, m, illegal);
+	DISK_PROF_END(VALIDATE_FILE);
+	values_rejected |= illegal;
 	return illegal;
 }
 u8 *find_file(u8 *pfilename, u16 *pfilelen, u16 *root_addr)
 {
-	u16 n, sector;
-	u8 str_name[11];
-	u8 *pdiraddr;
-
-	pdiraddr = ROOT_SECTOR;
+	u16 cluster;
+	u32 size;
+	int n = dir_find(pfilename, &cluster, &size);
 
-	for (n = 0; n < 16; n++)
+	if (n < 0)
 	{
-		memcpy(str_name, pdiraddr, 11);
-		Upper(str_name, 11);
-		if (memcmp(str_name, pfilename, 11) == 0)
-		{
-			memcpy((u8 *)pfilelen, pdiraddr + 0x1C, 2);
-			memcpy((u8 *)&sector, pdiraddr + 0x1A, 2);
-			if (root_addr)
-				*root_addr = n; // Return directory entry index
-			return (u8 *)FILE_SECTOR + (sector - 2) * SECTOR_SIZE;
-		}
-
-		pdiraddr += 32;
+		app_log_info("file search did not find requested file", NULL);
+		return NULL;
 	}
-	app_log_info("file search did not find requested file", NULL);
-	return NULL;
+	*pfilelen = size;
+	if (root_addr)
+		*root_addr = n; // Return directory entry index
+	if (cluster >= 2 && (u32)(cluster - 2) * SECTOR_SIZE >= FILE_SECTOR_SIZE)
+	{
+		app_log_warn("file starts at cluster %u, outside the buffered data area", cluster);
+		return NULL;
+	}
+	// An empty file has no cluster; read from cluster 2, where validate_file() puts it
+	return (u8 *)FILE_SECTOR + (cluster >= 2 ? cluster - 2 : 0) * SECTOR_SIZE;
 }
 static u8 flush_file(void)
 {
-	u32 k, m;
+	u32 k;
 	u8 illegal;
 	u16 file_len;
 	u8 *p_file;
@@ -685,51 +2736,83 @@ static u8 flush_file(void)
 		if (illegal)
 		{
 			// Defer flash write to avoid blocking USB enumeration
-			pending_flash_write = true;
-			last_write_tick = HAL_GetTick();
+			defer_flash_write();
 		}
 	}
 	else
 	{
-		memset(disk_buffer, 0x00, sizeof(disk_buffer));
-		memcpy(ROOT_SECTOR, &CONFIG_FILENAME, 0xC);
-		memcpy(FAT1_SECTOR, fat_data, 6);
-		memcpy(FAT2_SECTOR, fat_data, 6);
-
-		m = 0;
 		for (k = 0; k < FILE_ENTRY_CNT; k++)
 		{
-			// Skip unregistered entries
-			if (entries[k].entry[0] == '\0')
-				continue;
-			// Build line: entry=default_value\tcomment\r\n
-			size_t line_len = snprintf((char *)(FILE_SECTOR + m), FILE_SECTOR_SIZE - m,
-									   "%s=%s%s",
-									   entries[k].entry,
-									   entries[k].default_value ? entries[k].default_value : "",
-									   entries[k].comment);
-			m += line_len;
+			// Build line: entry=default_value (the comment is added by render_file)
+			snprintf((char *)parse_buffer[k], FILE_ROW_CNT, "%s=%s", entries[k].entry,
+					 entries[k].default_value ? entries[k].default_value : "");
 		}
-
-		disk_buffer[0x40B] = 0x0; // attributes
-		*(u32 *)VOLUME_BASE = VOLUME;
-		disk_buffer[0x41A] = 0x02; // cluster number
-		// File size (4 bytes for sizes > 255)
-		disk_buffer[0x41C] = m & 0xFF;
-		disk_buffer[0x41D] = (m >> 8) & 0xFF;
-		disk_buffer[0x41E] = (m >> 16) & 0xFF;
-		disk_buffer[0x41F] = (m >> 24) & 0xFF;
-		// Update FAT chain for the file size
-		update_fat_chain(m);
+		create_image();
 		// Defer flash write to avoid blocking USB enumeration
-		pending_flash_write = true;
-		last_write_tick = HAL_GetTick();
-		memset(page_dirty_mask, 1, sizeof(page_dirty_mask)); // Mark all pages dirty
+		defer_flash_write();
 	}
 
 	return 0;
 }
-void read_sector(u8 *pbuffer, u32 disk_addr)
+#if DISK_STATS
+// STATS.TXT: fixed size (padded with spaces) so the FAT chain never changes,
+// text snapshot taken whenever the host reads the root directory
+#define STATS_FIRST_SECTOR (SECTOR_CNT - DISK_STATS_SECTORS)
+#define STATS_FIRST_CLUSTER SECTOR_TO_CLUSTER(STATS_FIRST_SECTOR)
+#define STATS_FILE_SIZE (DISK_STATS_SECTORS * SECTOR_SIZE)
+static char stats_text[STATS_FILE_SIZE];
+
+static void stats_inject_dirent(u8 *dir)
+{
+	u32 len = DiskStats.render(stats_text, sizeof(stats_text) - 2);
+	memset(stats_text + len, ' ', sizeof(stats_text) - 2 - len);
+	memcpy(stats_text + sizeof(stats_text) - 2, "\r\n", 2);
+
+	// First free slot among the 16 entries the library manages
+	for (u32 n = 0; n < 16; n++)
+	{
+		u8 *entry = dir + n * 32;
+		if (entry[0] == 0x00 || entry[0] == 0xE5)
+		{
+			memset(entry, 0, 32);
+			memcpy(entry, DISK_STATS_FILENAME, 11);
+			entry[0x0B] = 0x01; // read-only
+			entry[0x1A] = STATS_FIRST_CLUSTER & 0xFF;
+			entry[0x1B] = STATS_FIRST_CLUSTER >> 8;
+			entry[0x1C] = STATS_FILE_SIZE & 0xFF;
+			entry[0x1D] = (STATS_FILE_SIZE >> 8) & 0xFF;
+			return;
+		}
+	}
+}
+
+// Hosts write back the directory they read, STATS.TXT included; it must not reach flash
+static void stats_strip_dirent(u8 *dir)
+{
+	for (u32 n = 0; n < 16; n++)
+	{
+		u8 *entry = dir + n * 32;
+		if (memcmp(entry, DISK_STATS_FILENAME, 11) == 0)
+		{
+			bool last = n == 15 || entry[32] == 0x00;
+			memset(entry, 0, 32);
+			entry[0] = last ? 0x00 : 0xE5;
+		}
+	}
+}
+
+// Adds the STATS.TXT chain to FAT sector fat_sector (0-11) as read by the host
+static void stats_inject_fat(u8 *pbuffer, u32 fat_sector)
+{
+	for (u32 c = STATS_FIRST_CLUSTER; c < STATS_FIRST_CLUSTER + DISK_STATS_SECTORS; c++)
+	{
+		fat_put(pbuffer, fat_sector, c, c + 1 < STATS_FIRST_CLUSTER + DISK_STATS_SECTORS ? c + 1 : 0xFFF);
+	}
+}
+#endif
+
+// Queues the transfers that produce one sector on the copy engine
+static void queue_read_sector(u8 *pbuffer, u32 disk_addr)
 {
 	// disk_addr is sector number (not byte offset)
 	// Boot sector layout (from BOOT_SEC):
@@ -742,115 +2825,199 @@ void read_sector(u8 *pbuffer, u32 disk_addr)
 	if (disk_addr == 0)
 	{
 		// Boot sector
-		app_log_trace("Reading BOOT sector: %lu", disk_addr);
-		memcpy(pbuffer, BOOT_SEC, SECTOR_SIZE);
+		DISK_TRACE_EVENT(READ_BOOT, disk_addr, 0);
+		copy_engine->start(pbuffer, BOOT_SEC, SECTOR_SIZE);
+		DISK_STATS_ADD(reads[DISK_REGION_BOOT], 1);
 	}
 	else if (disk_addr >= 1 && disk_addr <= 7)
 	{
 		// Reserved sectors (after boot) - return zeros
-		memset(pbuffer, 0, SECTOR_SIZE);
+		DISK_TRACE_EVENT(READ_BOOT, disk_addr, 0);
+		copy_engine->start(pbuffer, NULL, SECTOR_SIZE);
+		DISK_STATS_ADD(reads[DISK_REGION_BOOT], 1);
 	}
 	else if (disk_addr >= 8 && disk_addr <= 19)
 	{
+#if DISK_META_SYNTH
+		// FAT1 (12 sectors), synthesized
+		if (disk_addr == 8)
+		{
+			DISK_TRACE_EVENT(READ_FAT, 1, disk_addr);
+		}
+		synth_fat_sector(pbuffer, disk_addr - 8);
+#else
 		// FAT1 (12 sectors) - only first sector has data
 		if (disk_addr == 8)
 		{
-			app_log_trace("Reading FAT1 sector: %lu", disk_addr);
-			memcpy(pbuffer, FAT1_SECTOR, SECTOR_SIZE);
+			DISK_TRACE_EVENT(READ_FAT, 1, disk_addr);
+			copy_engine->start(pbuffer, FAT1_SECTOR, SECTOR_SIZE);
 		}
 		else
 		{
-			memset(pbuffer, 0, SECTOR_SIZE);
+			copy_engine->start(pbuffer, NULL, SECTOR_SIZE);
 		}
+#endif
+#if DISK_STATS
+		copy_engine->wait();
+		stats_inject_fat(pbuffer, disk_addr - 8);
+#endif
+		DISK_STATS_ADD(reads[DISK_REGION_FAT], 1);
 	}
 	else if (disk_addr >= 20 && disk_addr <= 31)
 	{
+#if DISK_META_SYNTH
+		// FAT2 (12 sectors), an alias of FAT1
+		if (disk_addr == 20)
+		{
+			DISK_TRACE_EVENT(READ_FAT, 2, disk_addr);
+		}
+		synth_fat_sector(pbuffer, disk_addr - 20);
+#else
 		// FAT2 (12 sectors) - only first sector has data
 		if (disk_addr == 20)
 		{
-			app_log_trace("Reading FAT2 sector: %lu", disk_addr);
-			memcpy(pbuffer, FAT2_SECTOR, SECTOR_SIZE);
+			DISK_TRACE_EVENT(READ_FAT, 2, disk_addr);
+			copy_engine->start(pbuffer, FAT2_SECTOR, SECTOR_SIZE);
 		}
 		else
 		{
-			memset(pbuffer, 0, SECTOR_SIZE);
+			copy_engine->start(pbuffer, NULL, SECTOR_SIZE);
 		}
+#endif
+#if DISK_STATS
+		copy_engine->wait();
+		stats_inject_fat(pbuffer, disk_addr - 20);
+#endif
+		DISK_STATS_ADD(reads[DISK_REGION_FAT], 1);
 	}
 	else if (disk_addr >= 32 && disk_addr <= 63)
 	{
 		// Root directory (32 sectors) - only first sector has entries
 		if (disk_addr == 32)
 		{
-			app_log_trace("Reading DIR sector: %lu", disk_addr);
-			memcpy(pbuffer, ROOT_SECTOR, SECTOR_SIZE);
-			// Log CONFIG.TXT entry details
-			u32 fsize = ROOT_SECTOR[0x1C] | (ROOT_SECTOR[0x1D] << 8) |
-						(ROOT_SECTOR[0x1E] << 16) | (ROOT_SECTOR[0x1F] << 24);
-			u16 cluster = ROOT_SECTOR[0x1A] | (ROOT_SECTOR[0x1B] << 8);
-			app_log_trace("DIR: CONFIG.TXT cluster=%u, size=%lu", cluster, fsize);
+			DISK_TRACE_EVENT(READ_DIR, disk_addr, 0);
+#if DISK_META_SYNTH
+			synth_dir_sector(pbuffer);
+			DISK_TRACE_EVENT(READ_DIR_CONFIG, files[0].cluster, files[0].size);
+#else
+			copy_engine->start(pbuffer, ROOT_SECTOR, SECTOR_SIZE);
+			DISK_TRACE_EVENT(READ_DIR_CONFIG, ROOT_SECTOR[0x1A] | (ROOT_SECTOR[0x1B] << 8),
+							 ROOT_SECTOR[0x1C] | (ROOT_SECTOR[0x1D] << 8) | (ROOT_SECTOR[0x1E] << 16) | (ROOT_SECTOR[0x1F] << 24));
+#endif
+#if DISK_STATS
+			copy_engine->wait();
+			stats_inject_dirent(pbuffer);
+#endif
 		}
 		else
 		{
-			memset(pbuffer, 0, SECTOR_SIZE);
+			copy_engine->start(pbuffer, NULL, SECTOR_SIZE);
 		}
+		DISK_STATS_ADD(reads[DISK_REGION_DIR], 1);
 	}
 	else if (disk_addr >= 64 && disk_addr < SECTOR_CNT)
 	{
 		// Data area (cluster 2 = sector 64)
 		u32 data_offset = (disk_addr - 64) * SECTOR_SIZE;
+		DISK_STATS_ADD(reads[DISK_REGION_DATA], 1);
 		// Check bounds - FILE_SECTOR has limited space in disk_buffer
-		// disk_buffer is 0x4000 bytes (16KB), FILE_SECTOR starts at 0x600
+		// disk_buffer is 0x4000 bytes (16KB), FILE_SECTOR starts at META_BYTES
 		// Available for file data: FILE_SECTOR_SIZE (~14KB)
+#if DISK_STATS
+		if (disk_addr >= STATS_FIRST_SECTOR)
+		{
+			copy_engine->start(pbuffer, stats_text + (disk_addr - STATS_FIRST_SECTOR) * SECTOR_SIZE, SECTOR_SIZE);
+		}
+		else
+#endif
 		if (data_offset + SECTOR_SIZE <= FILE_SECTOR_SIZE)
 		{
-			app_log_trace("Reading FILE sector: %lu", disk_addr);
-			memcpy(pbuffer, FILE_SECTOR + data_offset, SECTOR_SIZE);
-			// Log first bytes of sector 64 (start of file)
-			if (disk_addr == 64)
-			{
-				app_log_trace("FILE sector 64 content: %.40s", pbuffer);
-			}
+			DISK_TRACE_EVENT(READ_FILE, disk_addr, 0);
+			copy_engine->start(pbuffer, FILE_SECTOR + data_offset, SECTOR_SIZE);
 		}
 		else
 		{
 			// Beyond actual data - return zeros (unallocated space)
-			memset(pbuffer, 0, SECTOR_SIZE);
+			copy_engine->start(pbuffer, NULL, SECTOR_SIZE);
 		}
 	}
 	else
 	{
-		app_log_warn("Unrecognized disk sector read attempt: %lu", disk_addr);
-		memset(pbuffer, 0, SECTOR_SIZE);
+		app_log_warn("Unrecognized disk sector read attempt: %lu", disk_addr);
+		copy_engine->start(pbuffer, NULL, SECTOR_SIZE);
+	}
+}
+void read_sector(u8 *pbuffer, u32 disk_addr)
+{
+	DISK_PROF_BEGIN(READ_SECTOR);
+	queue_read_sector(pbuffer, disk_addr);
+	copy_engine->wait();
+	DISK_PROF_END(READ_SECTOR);
+}
+
+// Multi-sector read: the copies of all sectors run back to back on the engine
+static void read_sectors(u8 *pbuffer, u32 disk_addr, u32 count)
+{
+	for (u32 i = 0; i < count; i++)
+	{
+		queue_read_sector(pbuffer + i * SECTOR_SIZE, disk_addr + i);
 	}
+	copy_engine->wait();
 }
+
 u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 {
+#if !DISK_META_SYNTH
 	u32 i;
 	u8 ver[20];
 	static u8 txt_flag = 0;
 	u8 config_filesize = 0;
+#endif
+	DISK_PROF_BEGIN(WRITE_SECTOR);
+	debounce_host_write();
 
 	// diskaddr is sector number, length is number of sectors
-	// Copy incoming data to temp buffer
-	for (i = 0; i < length * SECTOR_SIZE; i++)
-	{
-		*(u8 *)(pdisk_buffer_temp + i) = buff[i];
-	}
-
 	// Process each sector
 	for (u32 s = 0; s < length; s++)
 	{
 		u32 sector = diskaddr + s;
-		u8 *sector_data = pdisk_buffer_temp + (s * SECTOR_SIZE);
+		u8 *sector_data = pdisk_buffer_temp;
+
+		// Copy incoming sector to temp buffer (holds one sector); also completes the
+		// previous sector's transfers into disk_buffer
+		copy_engine->start(pdisk_buffer_temp, buff + s * SECTOR_SIZE, SECTOR_SIZE);
+		copy_engine->wait();
 
+		DISK_STATS_ADD(writes[sector < 8 ? DISK_REGION_BOOT : sector < 32 ? DISK_REGION_FAT : sector < 64 ? DISK_REGION_DIR : DISK_REGION_DATA], 1);
+
+#if DISK_META_SYNTH
+		if (sector >= 8 && sector <= 31)
+		{
+			// FAT writes: the chains follow from the directory entries, nothing to keep
+		}
+		else if (sector == 32)
+		{
+			// Write ROOT DIR sector: only names, sizes and first clusters are kept.
+			// find_file() reads CONFIG.TXT where the host put it; validate_file()
+			// moves it to cluster 2.
+#if DISK_STATS
+			stats_strip_dirent(sector_data);
+#endif
+			synth_parse_dir(sector_data);
+		}
+		else if (sector >= 33 && sector <= 63)
+		{
+			// Only the first directory sector is served
+		}
+#else
 		if (sector >= 8 && sector <= 19)
 		{
 			// Write FAT1 sector
 			if (sector == 8)
 			{
-				if (memcmp(sector_data, FAT1_SECTOR, SECTOR_SIZE))
+				if (buffers_differ(sector_data, FAT1_SECTOR, SECTOR_SIZE))
 				{
-					memcpy(FAT1_SECTOR, sector_data, SECTOR_SIZE);
+					copy_engine->start(FAT1_SECTOR, sector_data, SECTOR_SIZE);
 					page_dirty_mask[0] = 1;
 				}
 			}
@@ -860,9 +3027,9 @@ u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 			// Write FAT2 sector
 			if (sector == 20)
 			{
-				if (memcmp(sector_data, FAT2_SECTOR, SECTOR_SIZE))
+				if (buffers_differ(sector_data, FAT2_SECTOR, SECTOR_SIZE))
 				{
-					memcpy(FAT2_SECTOR, sector_data, SECTOR_SIZE);
+					copy_engine->start(FAT2_SECTOR, sector_data, SECTOR_SIZE);
 					page_dirty_mask[0] = 1;
 				}
 			}
@@ -872,7 +3039,10 @@ u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 			// Write ROOT DIR sector
 			if (sector == 32)
 			{
-				if (memcmp(sector_data, ROOT_SECTOR, SECTOR_SIZE))
+#if DISK_STATS
+				stats_strip_dirent(sector_data);
+#endif
+				if (buffers_differ(sector_data, ROOT_SECTOR, SECTOR_SIZE))
 				{
 					memcpy(ROOT_SECTOR, sector_data, SECTOR_SIZE);
 					page_dirty_mask[1] = 1;
@@ -889,8 +3059,7 @@ u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 						{
 							config_filesize = entry[0x1C] | (entry[0x1D] << 8);
 							txt_flag = 1;
-							app_log_trace("CONFIG.TXT cluster=%u, size=%u",
-										  entry[0x1A] | (entry[0x1B] << 8), config_filesize);
+							DISK_TRACE_EVENT(WRITE_DIR_CONFIG, entry[0x1A] | (entry[0x1B] << 8), config_filesize);
 							break;
 						}
 						entry += 32;
@@ -908,6 +3077,7 @@ u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 				}
 			}
 		}
+#endif
 		else if (sector >= 64 && sector < SECTOR_CNT)
 		{
 			// Write DATA sector
@@ -933,50 +3103,23 @@ u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 				u16 config_cluster = get_config_start_cluster();
 
 				// Check if FILE_SECTOR already has valid CONFIG.TXT data (normalized)
-				bool file_sector_has_config = false;
-				for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
-				{
-					if (entries[k].entry[0] != '\0')
-					{
-						size_t entry_len = strlen(entries[k].entry);
-						if (memcmp(FILE_SECTOR, entries[k].entry, entry_len) == 0 &&
-							FILE_SECTOR[entry_len] == '=')
-						{
-							file_sector_has_config = true;
-							break;
-						}
-					}
-				}
+				bool file_sector_has_config = starts_with_entry(FILE_SECTOR);
 
 				// If this write is to CONFIG.TXT's cluster (per directory), allow it
 				if (config_cluster > 0 && write_cluster == config_cluster)
 				{
 					// This is CONFIG.TXT data - allow write
-					app_log_trace("allowing CONFIG.TXT write to cluster %u (sector %lu)", write_cluster, sector);
+					DISK_TRACE_EVENT(WRITE_ALLOW, write_cluster, sector);
 				}
 				// If this write is to cluster 2 (sector 64) - our normalized location
 				else if (write_cluster == 2)
 				{
 					// Check if incoming data looks like CONFIG.TXT
-					bool looks_like_config = false;
-					for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
-					{
-						if (entries[k].entry[0] != '\0')
-						{
-							size_t entry_len = strlen(entries[k].entry);
-							if (memcmp(sector_data, entries[k].entry, entry_len) == 0 &&
-								sector_data[entry_len] == '=')
-							{
-								looks_like_config = true;
-								break;
-							}
-						}
-					}
-
-					if (!looks_like_config)
+					if (!starts_with_entry(sector_data))
 					{
 						// This is NOT CONFIG.TXT - likely a dot file trying to use cluster 2
-						app_log_trace("rejecting non-config write to cluster 2 (sector %lu, first byte: 0x%02X)", sector, sector_data[0]);
+						DISK_TRACE_EVENT(WRITE_REJECT_CLUSTER2, sector, sector_data[0]);
+						DISK_STATS_ADD(rejected_writes, 1);
 						continue;
 					}
 				}
@@ -991,25 +3134,31 @@ u8 write_sector(u8 *buff, u32 diskaddr, u32 length) // PC Save data call
 
 					if (is_dot_file)
 					{
-						app_log_trace("rejecting dot file write to cluster %u (sector %lu)", write_cluster, sector);
+						DISK_TRACE_EVENT(WRITE_REJECT_DOT, write_cluster, sector);
+						DISK_STATS_ADD(rejected_writes, 1);
 						continue;
 					}
 				}
 			}
 
-			if (memcmp(sector_data, FILE_SECTOR + data_offset, SECTOR_SIZE))
+			if (buffers_differ(sector_data, FILE_SECTOR + data_offset, SECTOR_SIZE))
 			{
-				memcpy(FILE_SECTOR + data_offset, sector_data, SECTOR_SIZE);
-				page_dirty_mask[(data_offset / FLASH_PAGE_SIZE) + 1] = 1;
+				copy_engine->start(FILE_SECTOR + data_offset, sector_data, SECTOR_SIZE);
+				page_dirty_mask[(META_BYTES + data_offset) / FLASH_PAGE_SIZE] = 1;
 			}
 			// Don't validate here - defer to process() when all sectors received
+#if DISK_VALIDATE_AHEAD
+			pipe_landed(data_offset, sector_data);
+#endif
 		}
 	}
 
+	copy_engine->wait();
+
 	// Mark pending write instead of writing immediately
-	pending_flash_write = true;
-	last_write_tick = HAL_GetTick();
+	defer_flash_write();
 
+	DISK_PROF_END(WRITE_SECTOR);
 	return HAL_OK;
 }
 static u32 get_sector_size(void)
@@ -1020,15 +3169,191 @@ static u32 get_sector_count(void)
 {
 	return SECTOR_CNT;
 }
+#if DISK_STORE_TLV
+// Rebuild the whole volume from the newest committed values, false if nothing is stored
+static bool tlv_render(void)
+{
+	tlv_scan();
+	if (tlv_seq == 0)
+	{
+		return false;
+	}
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		if (tlv_latest[k] != TLV_NONE)
+		{
+			const disk_tlv_record_t *r = tlv_record(tlv_latest[k]);
+			snprintf((char *)parse_buffer[k], FILE_ROW_CNT, "%s=%.*s", entries[k].entry,
+					 (int)MIN(r->len, FILE_ROW_CNT - MAX_ENTRY_LABEL_LENGTH - 1), (const char *)(r + 1));
+		}
+		else
+		{
+			snprintf((char *)parse_buffer[k], FILE_ROW_CNT, "%s=%s", entries[k].entry,
+					 entries[k].default_value ? entries[k].default_value : "");
+		}
+	}
+	create_image();
+	return true;
+}
+
+// Hand the rendered values to the application without parsing CONFIG.TXT. Returns 1 if
+// an entry had no stored value or failed validation, so the store needs a commit.
+static u8 tlv_apply(void)
+{
+	u8 illegal = 0;
+	u32 len;
+
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		const u8 *value = tlv_value(k, &len);
+		if (value == NULL)
+		{
+			continue;
+		}
+		memset(value_buffer, 0, sizeof(value_buffer));
+		memcpy(value_buffer, value, MIN(len, FILE_ROW_CNT - 1));
+		u8 rejected = apply_value(k);
+		values_rejected |= rejected;
+		illegal |= rejected | (tlv_latest[k] == TLV_NONE);
+	}
+	create_image();
+	return illegal;
+}
+
+// Hand the values of an earlier commit to the application and render them into
+// CONFIG.TXT; the next commit stores them as the newest generation. Entries that commit
+// did not know keep their current value.
+static u8 tlv_restore(u32 generation)
+{
+	u32 offsets[FILE_ENTRY_CNT], commit_end;
+
+	if (generation == 0 || !tlv_lookup(generation, offsets, &commit_end))
+	{
+		app_log_warn("Config commit %lu is no longer stored (oldest %lu)", generation, tlv_oldest);
+		return HAL_ERROR;
+	}
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		if (offsets[k] == TLV_NONE)
+		{
+			continue;
+		}
+		const disk_tlv_record_t *r = tlv_record(offsets[k]);
+		memset(value_buffer, 0, sizeof(value_buffer));
+		memcpy(value_buffer, r + 1, MIN(r->len, FILE_ROW_CNT - 1));
+		values_rejected |= apply_value(k);
+	}
+	create_image();
+	app_log_info("Restored config commit %lu", generation);
+	return HAL_OK;
+}
+
+#if DISK_TLV_ROLLBACK
+static u8 ROLLBACK_FILENAME[] = "ROLLBACKTXT";
+
+// Generation asked for by a ROLLBACK.TXT the host wrote: "<commit>" or "-<commits back>".
+// The entry is removed either way. Returns 0 if there is no request.
+static u32 tlv_rollback_request(void)
+{
+	u16 cluster;
+	u32 size;
+	char text[12] = {0};
+	int slot = dir_find(ROLLBACK_FILENAME, &cluster, &size);
+
+	if (slot < 0)
+	{
+		return 0;
+	}
+	if (cluster >= 2 && (u32)(cluster - 2) * SECTOR_SIZE < FILE_SECTOR_SIZE)
+	{
+		memcpy(text, FILE_SECTOR + (cluster - 2) * SECTOR_SIZE, MIN(size, sizeof(text) - 1));
+	}
+#if DISK_META_SYNTH
+	memset(&files[slot], 0, sizeof(files[slot]));
+#else
+	ROOT_SECTOR[slot * 32] = 0xE5;
+	page_dirty_mask[1] = 1;
+#endif
+	long n = strtol(text, NULL, 10);
+	if (n < 0)
+	{
+		return (u32)-n < tlv_seq ? tlv_seq + n : 0;
+	}
+	return n;
+}
+#endif
+#endif
+
 static void load_from_flash(void)
 {
-	memcpy(disk_buffer, (u8 *)APP_BASE, sizeof(disk_buffer));
+	uintptr_t first, last;
+	u32 size;
+
+	// Erasing the region must not take code along: it has to start and end on unit boundaries,
+	// or nothing is ever programmed (the linker script should have refused it, see README)
+	region_misaligned = DiskFlash.unit(APP_BASE, &first, NULL) == DISK_FLASH_NONE ||
+						DiskFlash.unit(APP_BASE + APP_SIZE - 1, &last, &size) == DISK_FLASH_NONE ||
+						first != APP_BASE || last + size != APP_BASE + APP_SIZE;
+	if (region_misaligned)
+	{
+		app_log_error("User data region 0x%lx+0x%lx is not made of whole %s erase units, commits are refused",
+					  APP_BASE, APP_SIZE, DiskFlash.geometry()->name);
+	}
+	budget_init();
+#if DISK_VALIDATE_AHEAD
+	pipe_reset();
+#endif
+#if DISK_STORE_TLV
+	if (tlv_render())
+	{
+		memset(page_dirty_mask, 0, sizeof(page_dirty_mask));
+		app_log_debug("Rendered CONFIG.TXT from config commit %lu", tlv_seq);
+		return;
+	}
+#endif
+#if DISK_STORE_LOG
+	store_load();
+#elif DISK_STORE_TLV
+	memcpy(disk_buffer, (u8 *)APP_BASE, sizeof(disk_buffer)); // a raw image to migrate
+#else
+	page_map_load();
+	image_read(disk_buffer, 0, sizeof(disk_buffer));
+#endif
+#if DISK_META_SYNTH
+	// Only CONFIG.TXT is stored, at cluster 2. Blank flash: init() creates defaults.
+	memset(files, 0, sizeof(files));
+	if (FILE_SECTOR[0] != 0x00 && FILE_SECTOR[0] != 0xFF)
+	{
+		synth_config_only(strnlen((const char *)FILE_SECTOR, FILE_SECTOR_SIZE));
+	}
+#endif
 	memset(page_dirty_mask, 0, sizeof(page_dirty_mask));
 	app_log_debug("Loaded data from flash", NULL);
 }
 static void init(void)
 {
+#if DISK_CALLBACK_BUDGET_US
+	disk_prof_start_counter();
+#endif
+#if DISK_UPDATE_STEPS
+	memset(&updates, 0, sizeof(updates)); // every updater gets its value again
+#endif
 	load_from_flash();
+	// A new session: the host may be a different OS
+	memset(&debounce, 0, sizeof(debounce));
+	debounce.delay_ms = FLASH_WRITE_DELAY_MS;
+	DISK_STATS_SET(debounce_ms, debounce.delay_ms);
+#if DISK_STORE_TLV
+	if (tlv_seq)
+	{
+		if (tlv_apply())
+		{
+			defer_flash_write();
+		}
+		return;
+	}
+	defer_flash_write(); // first commit moves the configuration into the store
+#endif
 	flush_file(); // validate, normalize, create defaults
 }
 static u32 get_unused_idx()
@@ -1047,6 +3372,16 @@ static u32 get_unused_idx()
 static bool register_entry(char *entry, char *default_val, char *comment, void *validator, void *updater, void *printer)
 {
 	u32 idx = get_unused_idx();
+#if DISK_STORE_TLV
+	// Records are stored under the key alone: two entries sharing one would load each other's values
+	int other = tlv_entry(tlv_key(entry));
+	if (other >= 0)
+	{
+		app_log_error("Entry %s has the config store key 0x%04x of %s, rename it", entry, tlv_key(entry),
+					  entries[other].entry);
+		return false;
+	}
+#endif
 	if (idx < FILE_ENTRY_CNT)
 	{
 		strncpy(entries[idx].entry, entry, MAX_ENTRY_LABEL_LENGTH - 1);
@@ -1056,47 +3391,424 @@ static bool register_entry(char *entry, char *default_val, char *comment, void *
 		entries[idx].validate = validator;
 		entries[idx].update = updater;
 		entries[idx].print = printer;
+#if DISK_CALLBACK_BUDGET_US
+		callback.budget_us[idx] = DISK_CALLBACK_BUDGET_US;
+#endif
+#if DISK_STORE_TLV
+		tlv_keys[idx] = tlv_key(entries[idx].entry);
+#endif
 		return true;
 	}
 	return false;
 }
 
-static void process(void)
+// A commit stores values: count it if any were rejected or missing since the last one, in
+// whichever validation (host save, stepped pass, rollback, boot) that happened
+static void count_rejected(void)
 {
-	// Check if we have pending writes and enough time has passed
-	if (pending_flash_write && (HAL_GetTick() - last_write_tick >= FLASH_WRITE_DELAY_MS))
+	if (values_rejected)
+	{
+		DISK_STATS_ADD(validation_failures, 1);
+		values_rejected = false;
+	}
+}
+
+// Validate and commit. stepped: called from process(), which runs the updates the
+// validation queued (DISK_UPDATE_STEPS) before the commit; else, or after Disk.eject(),
+// they run here.
+static void commit(bool stepped)
+{
+	if (!pending_flash_write)
 	{
-		app_log_trace("Flushing deferred flash write", NULL);
+		return;
+	}
+	DISK_TRACE_EVENT(FLUSH_BEGIN, 0, 0);
+	DISK_PROF_BEGIN(FLUSH);
+	u32 start_tick = HAL_GetTick();
+	u32 saves = write_generation;
+#if ERASE_AHEAD
+	u32 erases = flash_erases;
+#endif
 
-		// Validate CONFIG.TXT before writing to flash (all sectors now received)
-		u16 file_len;
-		u16 root_addr = 0;
-		u8 *p_file = find_file((u8 *)&CONFIG_FILENAME, &file_len, &root_addr);
-		if (p_file && file_len > 0)
+	// Validate CONFIG.TXT before writing to flash (all sectors now received)
+	u16 file_len;
+	u16 root_addr = 0;
+	u8 *p_file = find_file((u8 *)&CONFIG_FILENAME, &file_len, &root_addr);
+#if DISK_STORE_TLV && DISK_TLV_ROLLBACK
+	// A rollback request replaces whatever the host saved in CONFIG.TXT
+	u32 generation = tlv_rollback_request();
+	bool restored = generation && tlv_restore(generation) == HAL_OK;
+#else
+	bool restored = false;
+#endif
+	if (!restored && p_file && file_len > 0)
+	{
+		validate_file(p_file, root_addr);
+#if DISK_UPDATE_STEPS
+		if (updates.pending)
 		{
+			if (stepped && !budget.eject)
+			{
+				// The commit stays pending: validated again once the queue is empty, it stores the printed values
+				DISK_PROF_END(FLUSH);
+				DISK_TRACE_EVENT(FLUSH_END, 0, 0);
+				return;
+			}
+			while (updates.pending)
+			{
+				update_next();
+			}
+			updates.reprint = false;
+			p_file = find_file((u8 *)&CONFIG_FILENAME, &file_len, &root_addr);
 			validate_file(p_file, root_addr);
 		}
+#else
+		(void)stepped;
+#endif
+	}
+
+	app_log_debug("Starting flash write...", NULL);
+	if (rewrite_dirty_flash_pages() != HAL_OK)
+	{
+		app_log_error("Error during deferred flash write", NULL);
+	}
+	else
+	{
+		app_log_debug("Flash write completed successfully", NULL);
+	}
+	// Host writes that landed while this commit ran (it may wait on an erase for a second, in
+	// the commit task) are not in flash yet: they get a commit of their own after the delay
+	pending_flash_write = write_generation != saves;
+	count_rejected();
+	budget.eject = false;
+	if (budget.holding)
+	{
+		budget.held_ms += HAL_GetTick() - budget.hold_tick;
+		budget.holding = false;
+	}
+	if (debounce.gaps)
+	{
+		debounce_sample(debounce.gap_max);
+	}
+	debounce.writes = 0;
+	debounce.gaps = 0;
+	debounce.gap_max = 0;
+	debounce.timed = false;
+	DiskStats.commit_done(HAL_GetTick() - start_tick);
+#if ERASE_AHEAD
+	if (flash_erases != erases)
+	{
+		DISK_STATS_ADD(erasing_commits, 1);
+	}
+	else if (erase_ahead_ms)
+	{
+		DISK_STATS_ADD(erase_ahead_hits, 1);
+		DISK_STATS_ADD(erase_ahead_saved_ms, erase_ahead_ms);
+	}
+	erase_ahead_ms = 0;
+	erase_ahead_armed = true;
+#endif
+	DISK_PROF_END(FLUSH);
+	DISK_TRACE_EVENT(FLUSH_END, 0, 0);
+}
+
+static void flush(void)
+{
+	commit(false);
+}
+
+#if ERASE_AHEAD
+// Idle work after a commit: erase whatever the next commit would otherwise have to
+static void erase_ahead(void)
+{
+	u32 erases = flash_erases;
+	u32 start_tick = HAL_GetTick();
+
+	erase_ahead_armed = false;
+	if (region_misaligned)
+	{
+		return;
+	}
+#if DISK_STORE_TLV
+	tlv_prepare();
+#else
+	store_prepare();
+#endif
+	if (flash_erases != erases)
+	{
+		erase_ahead_ms += HAL_GetTick() - start_tick;
+		DISK_STATS_ADD(erase_ahead_runs, 1);
+	}
+}
+#endif
+
+// Erases the next commit is expected to do, for the erase budget: the whole region when the
+// log or the config store has to start over (judged as erase-ahead does), the pages that
+// changed in the raw image. At least 1, so saves coalesce while the budget is spent.
+static u32 commit_erases(void)
+{
+#if !BUDGET
+	return 1;
+#elif DISK_STORE_LOG
+	return store_restarts() ? budget.units : 1;
+#elif DISK_STORE_TLV
+	u32 need;
+	return tlv_fits(&need) ? 1 : budget.units;
+#elif DISK_FLASH_SECTORS
+	return 1;
+#else
+	u32 n = 0;
+	for (u32 i = 0; i < IMAGE_PAGES; i++)
+	{
+		n += buffers_differ(&disk_buffer[i * FLASH_PAGE_SIZE], (u8 *)image_page(i), image_page_len(i));
+	}
+	return MAX(n, 1);
+#endif
+}
+
+// ms until the pending commit or erase-ahead is due. A query only: process() keeps the books.
+static u32 commit_deadline_ms(void)
+{
+	u32 elapsed = HAL_GetTick() - last_write_tick;
+
+	if (pending_flash_write)
+	{
+		if (budget.eject)
+		{
+			return 0;
+		}
+		if (elapsed < debounce.delay_ms)
+		{
+			return debounce.delay_ms - elapsed;
+		}
+		return budget_wait_ms(commit_erases());
+	}
+#if ERASE_AHEAD
+	if (erase_ahead_armed)
+	{
+		if (elapsed < DISK_ERASE_AHEAD_MS)
+		{
+			return DISK_ERASE_AHEAD_MS - elapsed;
+		}
+		// A compaction erases the whole region: wait until the budget can pay for it
+		return commit_erases() > 1 ? budget_wait_ms(budget.units) : 0;
+	}
+#endif
+	return DISK_NO_DEADLINE;
+}
+
+static u32 next_deadline_ms(void)
+{
+#if DISK_UPDATE_STEPS
+	if (updates.pending)
+	{
+		return 0;
+	}
+#endif
+	return commit_deadline_ms();
+}
 
-		app_log_debug("Starting flash write...", NULL);
-		if (rewrite_dirty_flash_pages() != HAL_OK)
+static void process(void)
+{
+#if DISK_VALIDATE_AHEAD
+	pipe_advance(); // validate what the host has written so far
+#endif
+#if STREAM_COMMIT
+	stage_step();
+#endif
+#if DISK_UPDATE_STEPS
+	// After Disk.eject() the commit runs the queue itself
+	if (updates.pending && !(budget.eject && pending_flash_write))
+	{
+		update_step(); // a due commit follows at the first call after the last update
+		return;
+	}
+#endif
+	// Check if we have pending writes and enough time has passed
+	if (commit_deadline_ms() != 0)
+	{
+		if (pending_flash_write && !budget.holding && HAL_GetTick() - last_write_tick >= debounce.delay_ms)
 		{
-			app_log_error("Error during deferred flash write", NULL);
+			// Over budget: keep coalescing host saves in RAM until the commit's erases are affordable.
+			// Held from when the delay ran out, however late this call comes.
+			budget.holding = true;
+			budget.hold_tick = last_write_tick + debounce.delay_ms;
+			budget.held++;
 		}
-		else
+		return;
+	}
+	if (pending_flash_write)
+	{
+		bool host = debounce.writes != 0;
+		commit(true);
+		debounce.timed = host;
+	}
+#if ERASE_AHEAD
+	else
+	{
+		erase_ahead();
+	}
+#endif
+}
+
+static void set_write_hook(void (*hook)(void))
+{
+	write_hook = hook;
+}
+
+static void set_copy_engine(const struct disk_copy_engine *engine)
+{
+	copy_engine->wait();
+	copy_engine = engine ? engine : &DiskCopyCpu;
+}
+
+static u32 get_generation(u32 *oldest)
+{
+#if DISK_STORE_TLV
+	if (oldest)
+	{
+		*oldest = tlv_oldest;
+	}
+	return tlv_seq;
+#else
+	if (oldest)
+	{
+		*oldest = 0;
+	}
+	return 0;
+#endif
+}
+
+static u8 restore(u32 generation)
+{
+#if DISK_STORE_TLV
+	if (tlv_restore(generation) != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+	pending_flash_write = false; // the restored values replace a pending host save
+	u8 status = rewrite_dirty_flash_pages();
+	count_rejected();
+	return status;
+#else
+	app_log_warn("Config history needs DISK_STORE_TLV (commit %lu)", generation);
+	return HAL_ERROR;
+#endif
+}
+
+static void eject(void)
+{
+	if (!pending_flash_write)
+	{
+		return; // an idle bus suspending: nothing to commit, and the next save keeps its delay
+	}
+	budget.eject = true;
+	if (write_hook)
+	{
+		write_hook(); // wake a sleeping main loop or the commit task
+	}
+}
+
+static void get_budget(disk_budget_t *out)
+{
+	u32 erases = flash_erases - budget.session_erases;
+	u32 uptime_ms = HAL_GetTick() - budget.start_tick;
+
+	budget_refill();
+	memset(out, 0, sizeof(*out));
+	out->per_hour_milli = BUDGET ? budget.rate : 0;
+	out->available = budget.credit > 0 ? (u32)(budget.credit / BUDGET_ERASE) : 0;
+	out->held = budget.held;
+	out->held_ms = budget.held_ms;
+	out->erases = erases;
+	out->units = budget.units;
+	out->endurance = DiskFlash.geometry()->endurance;
+	if (erases)
+	{
+		out->projected_days = (u32)MIN((uint64_t)out->endurance * budget.units * uptime_ms / erases / 86400000ULL,
+									   0xFFFFFFFFULL);
+	}
+}
+
+static bool set_callback_budget(const char *entry, u32 us)
+{
+#if DISK_CALLBACK_BUDGET_US
+	for (u32 k = 0; k < FILE_ENTRY_CNT; k++)
+	{
+		if (entries[k].entry[0] != '\0' && strcmp(entries[k].entry, entry) == 0)
+		{
+			callback.budget_us[k] = us;
+			return true;
+		}
+	}
+	app_log_warn("No entry %s to budget", entry);
+#else
+	(void)us;
+	app_log_warn("Callback budgets need DISK_CALLBACK_BUDGET_US (entry %s)", entry);
+#endif
+	return false;
+}
+
+static u32 get_callbacks(disk_callback_t *out, u32 max)
+{
+	u32 n = 0;
+
+#if DISK_CALLBACK_BUDGET_US
+	for (u32 k = 0; k < FILE_ENTRY_CNT && n < max; k++)
+	{
+		if (entries[k].entry[0] == '\0')
 		{
-			app_log_debug("Flash write completed successfully", NULL);
+			continue;
 		}
-		pending_flash_write = false;
+		out[n].entry = entries[k].entry;
+		out[n].budget_us = callback.budget_us[k];
+		memcpy(out[n].max_us, callback.max_us[k], sizeof(out[n].max_us));
+		out[n].overruns = callback.overruns[k];
+		n++;
 	}
+#else
+	(void)out;
+	(void)max;
+#endif
+	return n;
+}
+
+static u32 get_wear(u16 *counts, u32 max)
+{
+#if !DISK_STORE_LOG && !DISK_STORE_TLV && !DISK_FLASH_SECTORS
+	if (!map_active)
+	{
+		return 0;
+	}
+	max = MIN(max, MAP_REGION);
+	memcpy(counts, map_erases, max * sizeof(*counts));
+	return max;
+#else
+	(void)counts;
+	(void)max;
+	return 0;
+#endif
 }
 
 const struct disk Disk = {
 	.init = init,
 	.load_from_flash = load_from_flash,
 	.process = process,
+	.flush = flush,
+	.next_deadline_ms = next_deadline_ms,
+	.set_write_hook = set_write_hook,
+	.set_copy_engine = set_copy_engine,
 	.Disk_SecWrite = write_sector,
 	.Disk_SecRead = read_sector,
+	.Disk_SecReadMulti = read_sectors,
 	.get_sector_size = get_sector_size,
 	.get_sector_count = get_sector_count,
 	.register_entry = register_entry,
+	.get_generation = get_generation,
+	.restore = restore,
+	.get_wear = get_wear,
+	.eject = eject,
+	.get_budget = get_budget,
+	.set_callback_budget = set_callback_budget,
+	.get_callbacks = get_callbacks,
 };
@@ -0,0 +1,199 @@
+#include "disk_copy.h"
+#include "disk_prof.h"
+
+// CPU engine: transfers complete inside start()
+
+static void cpu_start(void *dst, const void *src, u32 len)
+{
+	if (src)
+	{
+		memcpy(dst, src, len);
+	}
+	else
+	{
+		memset(dst, 0, len);
+	}
+}
+
+static void cpu_wait(void)
+{
+}
+
+const struct disk_copy_engine DiskCopyCpu = {
+	.name = "cpu",
+	.start = cpu_start,
+	.wait = cpu_wait,
+};
+
+// DMA engine: DMA2 Stream0 channel 0, memory-to-memory (F4 only DMA2 can do this),
+// word transfers in bursts of 4 through the FIFO. Zero-fill reads one zero word with
+// source increment off. The completion interrupt starts the next queued transfer.
+
+#if DISK_COPY_DMA && defined(STM32F411xE)
+
+typedef struct {
+	void *dst;
+	const void *src;
+	u32 len;
+} transfer_t;
+
+static DMA_HandleTypeDef hdma;
+static transfer_t queue[DISK_COPY_DMA_QUEUE];
+static volatile u32 queue_head, queue_tail; // queued transfers: [tail, head)
+static transfer_t current; // the transfer on the stream
+static volatile bool dma_busy;
+static bool dma_ready;
+static const u32 zero_word = 0;
+
+// Start t on the stream, false if the HAL refuses it (HAL_BUSY, HAL_ERROR): the CPU has
+// copied it then, so nobody waits for a completion that never comes
+static bool dma_launch(const transfer_t *t)
+{
+	if (t->src)
+	{
+		hdma.Instance->CR |= DMA_SxCR_PINC;
+	}
+	else
+	{
+		hdma.Instance->CR &= ~DMA_SxCR_PINC;
+	}
+	current = *t;
+	dma_busy = true;
+	if (HAL_DMA_Start_IT(&hdma, (uint32_t)(t->src ? t->src : &zero_word), (uint32_t)t->dst, t->len / 4) == HAL_OK)
+	{
+		return true;
+	}
+	dma_busy = false;
+	cpu_start(t->dst, t->src, t->len);
+	return false;
+}
+
+static void dma_complete(DMA_HandleTypeDef *h)
+{
+	(void)h;
+	while (queue_tail != queue_head)
+	{
+		if (dma_launch(&queue[queue_tail++ % DISK_COPY_DMA_QUEUE]))
+		{
+			return;
+		}
+	}
+	dma_busy = false;
+}
+
+// A transfer error: copy the transfer again with the CPU and go on with the queue
+static void dma_error(DMA_HandleTypeDef *h)
+{
+	cpu_start(current.dst, current.src, current.len);
+	dma_complete(h);
+}
+
+static void dma_init(void)
+{
+	__HAL_RCC_DMA2_CLK_ENABLE();
+	hdma.Instance = DMA2_Stream0;
+	hdma.Init.Channel = DMA_CHANNEL_0;
+	hdma.Init.Direction = DMA_MEMORY_TO_MEMORY;
+	hdma.Init.PeriphInc = DMA_PINC_ENABLE;
+	hdma.Init.MemInc = DMA_MINC_ENABLE;
+	hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+	hdma.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+	hdma.Init.Mode = DMA_NORMAL;
+	hdma.Init.Priority = DMA_PRIORITY_LOW;
+	hdma.Init.FIFOMode = DMA_FIFOMODE_ENABLE; // required for memory-to-memory
+	hdma.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+	hdma.Init.MemBurst = DMA_MBURST_INC4;
+	hdma.Init.PeriphBurst = DMA_PBURST_INC4;
+	if (HAL_DMA_Init(&hdma) != HAL_OK)
+	{
+		app_log_error("Unable to init copy DMA", NULL);
+		return;
+	}
+	hdma.XferCpltCallback = dma_complete;
+	hdma.XferErrorCallback = dma_error;
+	// Must preempt the USB interrupt: read_sector waits for completion inside it
+	HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+	dma_ready = true;
+}
+
+static void dma_wait(void)
+{
+	while (dma_busy)
+	{
+	}
+}
+
+static void dma_start(void *dst, const void *src, u32 len)
+{
+	if (!dma_ready)
+	{
+		dma_init();
+	}
+	if (!dma_ready || len < DISK_COPY_DMA_MIN_BYTES || ((uintptr_t)dst | (uintptr_t)src | len) & 3)
+	{
+		dma_wait(); // keep the order of overlapping transfers
+		cpu_start(dst, src, len);
+		return;
+	}
+
+	transfer_t t = {dst, src, len};
+	while (queue_head - queue_tail >= DISK_COPY_DMA_QUEUE)
+	{
+	}
+	u32 primask = __get_PRIMASK();
+	__disable_irq();
+	if (!dma_busy)
+	{
+		dma_launch(&t);
+	}
+	else
+	{
+		queue[queue_head % DISK_COPY_DMA_QUEUE] = t;
+		queue_head++;
+	}
+	__set_PRIMASK(primask);
+}
+
+static void dma_irq_handler(void)
+{
+	HAL_DMA_IRQHandler(&hdma);
+}
+
+static const struct disk_copy_engine dma_engine = {
+	.name = "dma2",
+	.start = dma_start,
+	.wait = dma_wait,
+};
+#define DMA_ENGINE (&dma_engine)
+
+#else
+
+static void dma_irq_handler(void)
+{
+}
+#define DMA_ENGINE NULL
+
+#endif
+
+static u32 measure(const struct disk_copy_engine *engine, bool zero_fill)
+{
+	static u32 src[512 / 4], dst[512 / 4];
+	const u32 runs = 64;
+
+	disk_prof_start_counter();
+	u32 t0 = disk_prof_now();
+	for (u32 i = 0; i < runs; i++)
+	{
+		engine->start(dst, zero_fill ? NULL : src, sizeof(dst));
+	}
+	engine->wait();
+	return (disk_prof_now() - t0) / runs;
+}
+
+const struct disk_copy DiskCopy = {
+	.cpu = &DiskCopyCpu,
+	.dma = DMA_ENGINE,
+	.dma_irq_handler = dma_irq_handler,
+	.measure = measure,
+};
@@ -0,0 +1,193 @@
+#include "disk_flash.h"
+
+// Typical values from the device datasheets. F4 erase time depends on the parallelism
+// (x8/x16/x32) set by the supply voltage; x64 needs an external Vpp and is not used.
+#if defined(STM32F103xB)
+static const disk_flash_geometry_t geometry = {
+	.name = "STM32F103xB",
+	.base = 0x08000000,
+	.runs = {{0x400, 128, {20, 20, 20, 20}}},
+	.program_ns = {0, 52500, 0, 0},
+	.overwrite = DISK_FLASH_OVERWRITE_ZERO,
+	.endurance = 10000,
+};
+#elif DISK_FLASH_SECTORS
+#define F4_SECTORS                                       \
+	{                                                    \
+		{0x4000, 4, {400, 300, 250, 250}},               \
+		{0x10000, 1, {1200, 700, 550, 550}},             \
+		{0x20000, 3, {2000, 1300, 1000, 1000}},          \
+	}
+#define F4_RULES                                         \
+	{                                                    \
+		{1700, 1, FLASH_VOLTAGE_RANGE_1},                \
+		{2100, 2, FLASH_VOLTAGE_RANGE_2},                \
+		{2700, 4, FLASH_VOLTAGE_RANGE_3},                \
+	}
+static const disk_flash_geometry_t geometry = {
+#if defined(STM32F401xE)
+	.name = "STM32F401xE",
+#elif defined(STM32F411xE)
+	.name = "STM32F411xE",
+#else
+	.name = "STM32F446xE",
+#endif
+	.base = 0x08000000,
+	.runs = F4_SECTORS,
+	.program_ns = {16000, 16000, 16000, 16000},
+	.rules = F4_RULES,
+	.overwrite = DISK_FLASH_OVERWRITE_AND,
+	.endurance = 10000,
+};
+#elif defined(STM32L432xx)
+static const disk_flash_geometry_t geometry = {
+	.name = "STM32L432xC",
+	.base = 0x08000000,
+	.runs = {{0x800, 128, {22, 22, 22, 22}}},
+	.program_ns = {0, 0, 0, 81690},
+	.overwrite = DISK_FLASH_OVERWRITE_ZERO,
+	.endurance = 10000,
+};
+#elif defined(STM32G071xx)
+static const disk_flash_geometry_t geometry = {
+	.name = "STM32G071xB",
+	.base = 0x08000000,
+	.runs = {{0x800, 64, {22, 22, 22, 22}}},
+	.program_ns = {0, 0, 0, 85000},
+	.overwrite = DISK_FLASH_OVERWRITE_ZERO,
+	.endurance = 10000,
+};
+#endif
+
+// HAL TypeProgram by width: 1, 2, 4, 8 bytes
+static const u32 program_type[DISK_FLASH_WIDTHS] = {
+#if defined(STM32F103xB)
+	0, FLASH_TYPEPROGRAM_HALFWORD, FLASH_TYPEPROGRAM_WORD, FLASH_TYPEPROGRAM_DOUBLEWORD,
+#elif DISK_FLASH_SECTORS
+	FLASH_TYPEPROGRAM_BYTE, FLASH_TYPEPROGRAM_HALFWORD, FLASH_TYPEPROGRAM_WORD, FLASH_TYPEPROGRAM_DOUBLEWORD,
+#else
+	0, 0, 0, FLASH_TYPEPROGRAM_DOUBLEWORD,
+#endif
+};
+
+static const disk_flash_geometry_t *get_geometry(void)
+{
+	return &geometry;
+}
+
+// Voltage rule for DISK_FLASH_VOLTAGE_MV, NULL if the device has none
+static const disk_flash_rule_t *rule(void)
+{
+	const disk_flash_rule_t *r = NULL;
+
+	for (u32 i = 0; i < DISK_FLASH_RULES && geometry.rules[i].max_width; i++)
+	{
+		if (DISK_FLASH_VOLTAGE_MV >= geometry.rules[i].min_mv)
+		{
+			r = &geometry.rules[i];
+		}
+	}
+	return r;
+}
+
+static u32 width(void)
+{
+	const disk_flash_rule_t *r = rule();
+	u32 w = 0;
+
+	for (u32 i = 0; i < DISK_FLASH_WIDTHS; i++)
+	{
+		if (geometry.program_ns[i] && (r == NULL || (1U << i) <= r->max_width))
+		{
+			w = 1U << i;
+		}
+	}
+	return w;
+}
+
+static u32 unit(uintptr_t addr, uintptr_t *base, u32 *size)
+{
+	uintptr_t start = geometry.base;
+	u32 n = 0;
+
+	for (u32 i = 0; i < DISK_FLASH_RUNS && geometry.runs[i].count; i++)
+	{
+		const disk_flash_run_t *run = &geometry.runs[i];
+		if (addr >= start && addr < start + run->size * run->count)
+		{
+			u32 k = (addr - start) / run->size;
+			if (base)
+			{
+				*base = start + k * run->size;
+			}
+			if (size)
+			{
+				*size = run->size;
+			}
+			return n + k;
+		}
+		start += run->size * run->count;
+		n += run->count;
+	}
+	return DISK_FLASH_NONE;
+}
+
+static HAL_StatusTypeDef erase(uintptr_t addr)
+{
+	FLASH_EraseInitTypeDef init = {0};
+	uintptr_t base;
+	uint32_t error;
+	u32 n = unit(addr, &base, NULL);
+
+	if (n == DISK_FLASH_NONE)
+	{
+		return HAL_ERROR;
+	}
+#if defined(STM32F103xB)
+	(void)n;
+	init.TypeErase = FLASH_TYPEERASE_PAGES;
+	init.PageAddress = base;
+	init.NbPages = 1;
+#elif DISK_FLASH_SECTORS
+	(void)base;
+	init.TypeErase = FLASH_TYPEERASE_SECTORS;
+	init.Sector = n;
+	init.NbSectors = 1;
+	init.VoltageRange = rule() ? rule()->range : FLASH_VOLTAGE_RANGE_3; // sets the parallelism
+#else
+	(void)base;
+	init.TypeErase = FLASH_TYPEERASE_PAGES;
+	init.Page = n;
+	init.NbPages = 1;
+#if defined(STM32L432xx)
+	init.Banks = FLASH_BANK_1;
+#endif
+#endif
+	return HAL_FLASHEx_Erase(&init, &error);
+}
+
+static HAL_StatusTypeDef program(uintptr_t addr, const u8 *src, u32 width)
+{
+	uint64_t data = 0;
+	u32 i = __builtin_ctz(width);
+
+	if (width > 8 || !geometry.program_ns[i])
+	{
+		return HAL_ERROR;
+	}
+	memcpy(&data, src, width);
+#if defined(STM32F103xB)
+	// https://stackoverflow.com/questions/28498191/cant-write-to-flash-memory-after-erase
+	// grr... looks like by default you can only write once to flash w/o clearing this...
+	CLEAR_BIT(FLASH->CR, (FLASH_CR_PG));
+#endif
+	return HAL_FLASH_Program(program_type[i], addr, data);
+}
+
+const struct disk_flash DiskFlash = {
+	.geometry = get_geometry,
+	.unit = unit,
+	.width = width,
+	.erase = erase,
+	.program = program,
+};
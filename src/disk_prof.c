@@ -0,0 +1,92 @@
+#include "disk_prof.h"
+
+#define DISK_PROF_LABEL(id, label) label,
+static const char *const labels[DISK_PROF_PROBE_CNT] = {DISK_PROF_PROBES(DISK_PROF_LABEL)};
+#undef DISK_PROF_LABEL
+
+static const char *name(u32 probe)
+{
+	return probe < DISK_PROF_PROBE_CNT ? labels[probe] : "?";
+}
+
+static u32 ticks_per_us(void)
+{
+#if defined(__ARM_ARCH)
+	return SystemCoreClock / 1000000;
+#else
+	return 1000;
+#endif
+}
+
+#if DISK_PROF
+
+static disk_prof_probe_t probes[DISK_PROF_PROBE_CNT];
+
+static void reset(void)
+{
+	memset(probes, 0, sizeof(probes));
+	for (u32 i = 0; i < DISK_PROF_PROBE_CNT; i++)
+	{
+		probes[i].min = UINT32_MAX;
+	}
+}
+
+static void init(void)
+{
+	disk_prof_start_counter();
+	reset();
+}
+
+// A handful of instructions, so probes stay well under 1% of the stages they time
+static void record(u32 probe, u32 ticks)
+{
+	disk_prof_probe_t *p = &probes[probe];
+	u32 bin = ticks ? 32 - __builtin_clz(ticks) : 0;
+
+	p->count++;
+	p->total += ticks;
+	p->min = ticks < p->min ? ticks : p->min;
+	p->max = ticks > p->max ? ticks : p->max;
+	p->hist[bin < DISK_PROF_HIST_BINS ? bin : DISK_PROF_HIST_BINS - 1]++;
+}
+
+static const disk_prof_probe_t *get(u32 probe)
+{
+	return probe < DISK_PROF_PROBE_CNT ? &probes[probe] : NULL;
+}
+
+static void dump(void)
+{
+	u32 scale = ticks_per_us();
+	for (u32 i = 0; i < DISK_PROF_PROBE_CNT; i++)
+	{
+		const disk_prof_probe_t *p = &probes[i];
+		if (p->count == 0)
+		{
+			continue;
+		}
+		app_log_info("%-16s n=%lu min=%lu max=%lu mean=%lu us", labels[i], (unsigned long)p->count,
+					 (unsigned long)(p->min / scale), (unsigned long)(p->max / scale),
+					 (unsigned long)(p->total / p->count / scale));
+	}
+}
+
+#else
+
+static void init(void) {}
+static void reset(void) {}
+static void record(u32 probe, u32 ticks) { (void)probe; (void)ticks; }
+static const disk_prof_probe_t *get(u32 probe) { (void)probe; return NULL; }
+static void dump(void) {}
+
+#endif
+
+const struct disk_prof DiskProf = {
+	.init = init,
+	.reset = reset,
+	.record = record,
+	.get = get,
+	.name = name,
+	.ticks_per_us = ticks_per_us,
+	.dump = dump,
+};
@@ -0,0 +1,127 @@
+#include "disk_rtos.h"
+
+#if defined(DISK_USE_FREERTOS)
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+// Notification bits posted to the commit task
+#define EVT_HOST_WRITE (1UL << 0)
+#define EVT_DEBOUNCE_EXPIRED (1UL << 1)
+
+static TaskHandle_t commit_task_handle = NULL;
+static TimerHandle_t debounce_timer = NULL;
+
+// USB MSC writes arrive from the OTG interrupt on target, but from a task on the POSIX port
+static bool in_isr(void)
+{
+#if defined(__ARM_ARCH)
+	return __get_IPSR() != 0;
+#else
+	return false;
+#endif
+}
+
+// Write hook installed into Disk: just wake the commit task, all work happens there
+static void on_host_write(void)
+{
+	if (commit_task_handle == NULL)
+	{
+		return;
+	}
+	if (in_isr())
+	{
+		BaseType_t woken = pdFALSE;
+		xTaskNotifyFromISR(commit_task_handle, EVT_HOST_WRITE, eSetBits, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
+	else
+	{
+		xTaskNotify(commit_task_handle, EVT_HOST_WRITE, eSetBits);
+	}
+}
+
+static void on_debounce_expired(TimerHandle_t timer)
+{
+	(void)timer;
+	xTaskNotify(commit_task_handle, EVT_DEBOUNCE_EXPIRED, eSetBits);
+}
+
+static void commit_task(void *arg)
+{
+	uint32_t events;
+	(void)arg;
+
+	for (;;)
+	{
+		// Block until the host writes or the debounce window closes - no polling
+		xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+		if (events & EVT_HOST_WRITE)
+		{
+			// Host is still writing: validate what landed (DISK_VALIDATE_AHEAD) and restart the
+			// window, a stale expiry is ignored. Its length comes from the library, which may
+			// adapt it to the host (DISK_DEBOUNCE_ADAPTIVE).
+			Disk.process();
+			u32 wait = Disk.next_deadline_ms();
+			if (wait != DISK_NO_DEADLINE)
+			{
+				xTimerChangePeriod(debounce_timer, pdMS_TO_TICKS(MAX(wait, 1)), portMAX_DELAY);
+			}
+		}
+		else if (events & EVT_DEBOUNCE_EXPIRED)
+		{
+			app_log_trace("debounce expired, committing", NULL);
+			Disk.process(); // not flush(): a commit the delay fired teaches DISK_DEBOUNCE_ADAPTIVE
+			// Queued updates, a commit held by the erase budget and erase-ahead (DISK_ERASE_AHEAD_MS)
+			// come back through the timer when they are due
+			u32 wait = Disk.next_deadline_ms();
+			if (wait != DISK_NO_DEADLINE)
+			{
+				xTimerChangePeriod(debounce_timer, pdMS_TO_TICKS(MAX(wait, 1)), portMAX_DELAY);
+			}
+		}
+	}
+}
+
+static bool start(void)
+{
+	if (commit_task_handle != NULL)
+	{
+		return true;
+	}
+
+	debounce_timer = xTimerCreate("disk_debounce", pdMS_TO_TICKS(FLASH_WRITE_DELAY_MS), pdFALSE, NULL, on_debounce_expired);
+	if (debounce_timer == NULL)
+	{
+		app_log_error("Unable to create debounce timer", NULL);
+		return false;
+	}
+	if (xTaskCreate(commit_task, "disk_commit", DISK_RTOS_STACK_WORDS, NULL, DISK_RTOS_TASK_PRIORITY, &commit_task_handle) != pdPASS)
+	{
+		app_log_error("Unable to create commit task", NULL);
+		xTimerDelete(debounce_timer, 0);
+		debounce_timer = NULL;
+		return false;
+	}
+
+	Disk.set_write_hook(on_host_write);
+	// Disk.init() may already have deferred a write (fresh defaults), arm the window once
+	xTaskNotify(commit_task_handle, EVT_HOST_WRITE, eSetBits);
+	return true;
+}
+
+#else
+
+static bool start(void)
+{
+	app_log_error("disk_rtos.c built without DISK_USE_FREERTOS", NULL);
+	return false;
+}
+
+#endif
+
+const struct disk_rtos DiskRtos = {
+	.start = start,
+};
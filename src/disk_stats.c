@@ -0,0 +1,177 @@
+#include "disk_stats.h"
+#include "disk_prof.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+#if DISK_STATS
+
+disk_stats_t disk_stats_counters;
+
+static const char *const region_names[DISK_REGION_CNT] = {"boot", "fat", "dir", "data"};
+
+static const disk_stats_t *get(void)
+{
+	return &disk_stats_counters;
+}
+
+static void reset(void)
+{
+	u32 debounce_ms = disk_stats_counters.debounce_ms; // a setting, not a counter
+	memset(&disk_stats_counters, 0, sizeof(disk_stats_counters));
+	disk_stats_counters.debounce_ms = debounce_ms;
+}
+
+static void commit_done(u32 ms)
+{
+	u32 bin = ms ? 32 - __builtin_clz(ms) : 0;
+	disk_stats_counters.commits++;
+	disk_stats_counters.commit_ms_max = MAX(disk_stats_counters.commit_ms_max, ms);
+	disk_stats_counters.commit_ms_hist[MIN(bin, DISK_STATS_HIST_BINS - 1)]++;
+}
+
+// snprintf that keeps appending safely once the buffer is full
+static u32 append(char *out, u32 cap, u32 len, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+static u32 append(char *out, u32 cap, u32 len, const char *fmt, ...)
+{
+	va_list args;
+	if (len >= cap)
+	{
+		return len;
+	}
+	va_start(args, fmt);
+	int n = vsnprintf(out + len, cap - len, fmt, args);
+	va_end(args);
+	return n < 0 ? len : MIN(len + (u32)n, cap - 1);
+}
+
+static u32 render(char *out, u32 cap)
+{
+	const disk_stats_t *st = &disk_stats_counters;
+	u32 i, len = 0;
+
+	len = append(out, cap, len, "uptime_s=%lu\r\n", (unsigned long)(HAL_GetTick() / 1000));
+	len = append(out, cap, len, "sector_reads=");
+	for (i = 0; i < DISK_REGION_CNT; i++)
+	{
+		len = append(out, cap, len, "%s%s:%lu", i ? " " : "", region_names[i], (unsigned long)st->reads[i]);
+	}
+	len = append(out, cap, len, "\r\nsector_writes=");
+	for (i = 0; i < DISK_REGION_CNT; i++)
+	{
+		len = append(out, cap, len, "%s%s:%lu", i ? " " : "", region_names[i], (unsigned long)st->writes[i]);
+	}
+	len = append(out, cap, len, "\r\ncommits=%lu\r\ncommit_ms_max=%lu\r\ncommit_ms_hist=",
+				 (unsigned long)st->commits, (unsigned long)st->commit_ms_max);
+	for (i = 0; i < DISK_STATS_HIST_BINS; i++)
+	{
+		if (st->commit_ms_hist[i])
+		{
+			len = append(out, cap, len, "<%lu:%lu ", 1UL << i, (unsigned long)st->commit_ms_hist[i]);
+		}
+	}
+	len = append(out, cap, len, "\r\nerases_per_page=");
+	for (i = 0; i < DISK_STATS_PAGES; i++)
+	{
+		len = append(out, cap, len, "%s%lu", i ? " " : "", (unsigned long)st->erases[i]);
+	}
+	len = append(out, cap, len, "\r\nbytes_programmed=%lu\r\nprogram_errors=%lu\r\nrejected_writes=%lu\r\n"
+								"validation_failures=%lu\r\n",
+				 (unsigned long)st->bytes_programmed, (unsigned long)st->program_errors,
+				 (unsigned long)st->rejected_writes, (unsigned long)st->validation_failures);
+	len = append(out, cap, len, "debounce_ms=%lu\r\nearly_commits=%lu\r\n", (unsigned long)st->debounce_ms,
+				 (unsigned long)st->early_commits);
+#if DISK_VERIFY
+	len = append(out, cap, len, "verify_failures=%lu\r\nretired_pages=%lu\r\n", (unsigned long)st->verify_failures,
+				 (unsigned long)st->retired_pages);
+#endif
+	u16 wear[64];
+	u32 pages = Disk.get_wear(wear, sizeof(wear) / sizeof(wear[0]));
+	if (pages)
+	{
+		len = append(out, cap, len, "page_wear=");
+		for (i = 0; i < pages; i++)
+		{
+			len = append(out, cap, len, "%s%u", i ? " " : "", wear[i]);
+		}
+		len = append(out, cap, len, "\r\n");
+	}
+	disk_budget_t budget;
+	Disk.get_budget(&budget);
+	if (budget.per_hour_milli)
+	{
+		len = append(out, cap, len, "erase_budget=per_hour:%lu.%03lu available:%lu held:%lu held_ms:%lu\r\n",
+					 (unsigned long)(budget.per_hour_milli / 1000), (unsigned long)(budget.per_hour_milli % 1000),
+					 (unsigned long)budget.available, (unsigned long)budget.held, (unsigned long)budget.held_ms);
+	}
+	len = append(out, cap, len, "lifetime=erases:%lu units:%lu endurance:%lu projected_days:%lu\r\n",
+				 (unsigned long)budget.erases, (unsigned long)budget.units, (unsigned long)budget.endurance,
+				 (unsigned long)budget.projected_days);
+#if DISK_VALIDATE_AHEAD
+	len = append(out, cap, len, "validated_ahead=%lu\r\n", (unsigned long)st->validated_ahead);
+#endif
+#if DISK_STREAM_COMMIT && DISK_STORE_LOG && DISK_VALIDATE_AHEAD
+	len = append(out, cap, len, "stream=commits:%lu sectors:%lu voided:%lu\r\n", (unsigned long)st->streamed_commits,
+				 (unsigned long)st->streamed_sectors, (unsigned long)st->stream_voided);
+#endif
+#if DISK_CALLBACK_BUDGET_US
+	disk_callback_t callbacks[8];
+	u32 n = Disk.get_callbacks(callbacks, sizeof(callbacks) / sizeof(callbacks[0])), overruns = 0;
+	len = append(out, cap, len, "callback_us=");
+	for (i = 0; i < n; i++)
+	{
+		len = append(out, cap, len, "%s%s:%lu/%lu/%lu", i ? " " : "", callbacks[i].entry,
+					 (unsigned long)callbacks[i].max_us[DISK_CALLBACK_VALIDATE],
+					 (unsigned long)callbacks[i].max_us[DISK_CALLBACK_UPDATE],
+					 (unsigned long)callbacks[i].max_us[DISK_CALLBACK_PRINT]);
+		overruns += callbacks[i].overruns;
+	}
+	len = append(out, cap, len, "\r\ncallback_overruns=%lu", (unsigned long)overruns);
+	for (i = 0; i < n; i++)
+	{
+		if (callbacks[i].overruns)
+		{
+			len = append(out, cap, len, " %s:%lu", callbacks[i].entry, (unsigned long)callbacks[i].overruns);
+		}
+	}
+	len = append(out, cap, len, "\r\n");
+#endif
+#if DISK_UPDATE_STEPS
+	len = append(out, cap, len, "update_steps=updates:%lu steps:%lu\r\n", (unsigned long)st->stepped_updates,
+				 (unsigned long)st->update_steps);
+#endif
+#if DISK_ERASE_AHEAD_MS && (DISK_STORE_LOG || DISK_STORE_TLV)
+	len = append(out, cap, len, "erasing_commits=%lu\r\nerase_ahead=runs:%lu hits:%lu saved_ms:%lu\r\n",
+				 (unsigned long)st->erasing_commits, (unsigned long)st->erase_ahead_runs,
+				 (unsigned long)st->erase_ahead_hits, (unsigned long)st->erase_ahead_saved_ms);
+#endif
+#if DISK_PROF
+	u32 scale = DiskProf.ticks_per_us();
+	for (i = 0; i < DISK_PROF_PROBE_CNT; i++)
+	{
+		const disk_prof_probe_t *p = DiskProf.get(i);
+		if (p->count)
+		{
+			len = append(out, cap, len, "us[%s]=n:%lu min:%lu mean:%lu max:%lu\r\n", DiskProf.name(i),
+						 (unsigned long)p->count, (unsigned long)(p->min / scale),
+						 (unsigned long)(p->total / p->count / scale), (unsigned long)(p->max / scale));
+		}
+	}
+#endif
+	return len;
+}
+
+#else
+
+static u32 render(char *out, u32 cap) { (void)out; (void)cap; return 0; }
+static const disk_stats_t *get(void) { return NULL; }
+static void reset(void) {}
+static void commit_done(u32 ms) { (void)ms; }
+
+#endif
+
+const struct disk_stats DiskStats = {
+	.render = render,
+	.get = get,
+	.reset = reset,
+	.commit_done = commit_done,
+};
@@ -0,0 +1,187 @@
+#include "disk_store.h"
+
+#define LITERAL_MAX 128
+#define ZERO_RUN_MIN 3
+#define ZERO_RUN_MAX 0x4000
+#define MATCH_MIN 4
+#define MATCH_MAX (0x3F + MATCH_MIN)
+#define MATCH_DIST_MAX 0x10000
+#define HASH_BITS 8
+#define NO_POS 0xFFFF // streams are shorter than 64KB
+
+// Single-slot hash of the last position where each 3-byte prefix was seen: 512 bytes of
+// RAM, good enough for text where the repeats are key names and padding
+static u16 head[1 << HASH_BITS];
+static void (*out_emit)(const u8 *p, u32 n);
+static u32 out_len;
+
+static u32 hash3(const u8 *p)
+{
+	return (u32)((p[0] | p[1] << 8 | (u32)p[2] << 16) * 2654435761UL) >> (32 - HASH_BITS);
+}
+
+static void put(const u8 *p, u32 n)
+{
+	if (out_emit)
+	{
+		out_emit(p, n);
+	}
+	out_len += n;
+}
+
+static void put_literals(const u8 *src, u32 start, u32 end)
+{
+	while (start < end)
+	{
+		u8 token = MIN(end - start, LITERAL_MAX) - 1;
+		put(&token, 1);
+		put(src + start, token + 1);
+		start += token + 1;
+	}
+}
+
+static u32 compress_more(const u8 *src, u32 start, u32 len, void (*emit)(const u8 *p, u32 n))
+{
+	u32 pos = start, literal_start = start;
+
+	out_emit = emit;
+	out_len = 0;
+	if (start == 0)
+	{
+		memset(head, 0xFF, sizeof(head));
+	}
+	while (pos < len)
+	{
+		u32 zeros = 0;
+		while (pos + zeros < len && src[pos + zeros] == 0 && zeros < ZERO_RUN_MAX)
+		{
+			zeros++;
+		}
+		if (zeros >= ZERO_RUN_MIN)
+		{
+			u8 token[2] = {0x80 | (zeros - 1) >> 8, (zeros - 1) & 0xFF};
+			put_literals(src, literal_start, pos);
+			put(token, sizeof(token));
+			pos += zeros;
+			literal_start = pos;
+			continue;
+		}
+
+		u32 best = 0, dist = 0;
+		if (pos + MATCH_MIN <= len)
+		{
+			u32 h = hash3(src + pos);
+			u32 cand = head[h];
+			head[h] = pos;
+			if (cand != NO_POS && pos - cand <= MATCH_DIST_MAX)
+			{
+				u32 limit = MIN(MATCH_MAX, len - pos);
+				while (best < limit && src[cand + best] == src[pos + best])
+				{
+					best++;
+				}
+				dist = pos - cand;
+			}
+		}
+		if (best >= MATCH_MIN)
+		{
+			u8 token[3] = {0xC0 | (best - MATCH_MIN), (dist - 1) & 0xFF, (dist - 1) >> 8};
+			put_literals(src, literal_start, pos);
+			put(token, sizeof(token));
+			for (u32 k = 1; k < best && pos + k + 3 <= len; k++)
+			{
+				head[hash3(src + pos + k)] = pos + k;
+			}
+			pos += best;
+			literal_start = pos;
+			continue;
+		}
+		pos++;
+	}
+	put_literals(src, literal_start, len);
+	return out_len;
+}
+
+static u32 compress(const u8 *src, u32 len, void (*emit)(const u8 *p, u32 n))
+{
+	return compress_more(src, 0, len, emit);
+}
+
+static u32 decompress(const u8 *src, u32 src_len, u8 *dst, u32 dst_len)
+{
+	u32 in = 0, out = 0, n;
+
+	while (in < src_len)
+	{
+		u8 token = src[in++];
+		if (token < 0x80)
+		{
+			n = token + 1;
+			if (in + n > src_len || out + n > dst_len)
+			{
+				return 0;
+			}
+			memcpy(dst + out, src + in, n);
+			in += n;
+		}
+		else if (token < 0xC0)
+		{
+			if (in >= src_len)
+			{
+				return 0;
+			}
+			n = ((token & 0x3F) << 8 | src[in++]) + 1;
+			if (out + n > dst_len)
+			{
+				return 0;
+			}
+			memset(dst + out, 0, n);
+		}
+		else
+		{
+			if (in + 2 > src_len)
+			{
+				return 0;
+			}
+			n = (token & 0x3F) + MATCH_MIN;
+			u32 dist = (src[in] | src[in + 1] << 8) + 1;
+			in += 2;
+			if (dist > out || out + n > dst_len)
+			{
+				return 0;
+			}
+			// Byte by byte: a match may overlap the bytes it produces
+			for (u32 k = 0; k < n; k++)
+			{
+				dst[out + k] = dst[out + k - dist];
+			}
+		}
+		out += n;
+	}
+	return out == dst_len ? out : 0;
+}
+
+// CRC-32 (IEEE, reflected), 4 bits at a time from a 64-byte table
+static u32 crc32(u32 crc, const u8 *p, u32 len)
+{
+	static const u32 table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+	};
+
+	crc = ~crc;
+	while (len--)
+	{
+		crc ^= *p++;
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+const struct disk_store DiskStore = {
+	.compress = compress,
+	.compress_more = compress_more,
+	.decompress = decompress,
+	.crc32 = crc32,
+};
@@ -0,0 +1,79 @@
+#include "disk_trace.h"
+
+#if DISK_TRACE
+
+#if (DISK_TRACE_DEPTH & (DISK_TRACE_DEPTH - 1)) != 0
+#error "DISK_TRACE_DEPTH must be a power of two"
+#endif
+
+static disk_trace_rec_t ring[DISK_TRACE_DEPTH];
+static u32 head; // total records ever written, ring index is head % DISK_TRACE_DEPTH
+
+static void reset(void)
+{
+	head = 0;
+}
+
+static void init(void)
+{
+	disk_prof_start_counter();
+	reset();
+}
+
+// Host writes arrive in the USB interrupt while process() runs in thread mode,
+// so claiming a slot has to be atomic
+static void record(u32 event, u32 arg0, u32 arg1)
+{
+#if defined(__ARM_ARCH)
+	u32 primask = __get_PRIMASK();
+	__disable_irq();
+	disk_trace_rec_t *rec = &ring[head++ & (DISK_TRACE_DEPTH - 1)];
+	__set_PRIMASK(primask);
+#else
+	disk_trace_rec_t *rec = &ring[__atomic_fetch_add(&head, 1, __ATOMIC_RELAXED) & (DISK_TRACE_DEPTH - 1)];
+#endif
+	rec->timestamp = disk_prof_now();
+	rec->event = event;
+	rec->arg[0] = arg0;
+	rec->arg[1] = arg1;
+}
+
+static u32 export(u8 *out, u32 cap)
+{
+	disk_trace_header_t header;
+	u32 end = head;
+	u32 count = MIN(end, DISK_TRACE_DEPTH);
+
+	if (cap < sizeof(header))
+	{
+		return 0;
+	}
+	count = MIN(count, (cap - sizeof(header)) / sizeof(disk_trace_rec_t));
+	header.magic = DISK_TRACE_MAGIC;
+	header.ticks_per_us = DiskProf.ticks_per_us();
+	header.count = count;
+	header.dropped = end - count;
+	memcpy(out, &header, sizeof(header));
+	for (u32 i = 0; i < count; i++)
+	{
+		memcpy(out + sizeof(header) + i * sizeof(disk_trace_rec_t),
+			   &ring[(end - count + i) & (DISK_TRACE_DEPTH - 1)], sizeof(disk_trace_rec_t));
+	}
+	return sizeof(header) + count * sizeof(disk_trace_rec_t);
+}
+
+#else
+
+static void init(void) {}
+static void reset(void) {}
+static void record(u32 event, u32 arg0, u32 arg1) { (void)event; (void)arg0; (void)arg1; }
+static u32 export(u8 *out, u32 cap) { (void)out; (void)cap; return 0; }
+
+#endif
+
+const struct disk_trace DiskTrace = {
+	.init = init,
+	.reset = reset,
+	.record = record,
+	.export = export,
+};